@@ -39,49 +39,41 @@ Global initial seed: 4208275479      argv[1]= 100     argv[2]= 1000000
 #include <iomanip>   // For setting precision
 
 // Added includes
-#include <armpl.h>
 // #include <arm_sve.h>
 // #include <arm_neon.h>
-#ifdef _OPENMP
-#include <omp.h>
-#endif
+#include <string>
+
+// Timer, ArmPL RNG helpers and per thread streams
+#include "engines/mc_utils.hxx"
+// r(t), q(t) and sigma(t) curves
+#include "engines/curves.hxx"
+#include "engines/checkpoint.hxx"
+// Pricing modes, selected with the optional third argument
+#include "engines/multi_maturity.hxx"
+#include "engines/payoff_set.hxx"
+#include "engines/greeks.hxx"
+#include "engines/aad.hxx"
+#include "engines/path_dependent.hxx"
+#include "engines/barrier.hxx"
+#include "engines/basket.hxx"
+#include "engines/heston.hxx"
+#include "engines/merton.hxx"
+#include "engines/local_vol.hxx"
+#include "engines/american.hxx"
+#include "engines/analytic_batch.hxx"
+#include "engines/implied_vol.hxx"
+#include "engines/pde.hxx"
+#include "engines/cos.hxx"
+#include "engines/lattice.hxx"
+#include "engines/quadrature.hxx"
+#include "engines/chebyshev.hxx"
+#include "engines/growth_index.hxx"
+#include "engines/var.hxx"
+#include "engines/sketch.hxx"
+#include "engines/payoff_dsl.hxx"
+#include "engines/pricing_api.hxx"
 //
 
-#define ui64 u_int64_t
-
-#include <sys/time.h>
-double
-dml_micros()
-{
-        static struct timezone tz;
-        static struct timeval  tv;
-        gettimeofday(&tv,&tz);
-        return((tv.tv_sec*1000000.0)+tv.tv_usec);
-}
-
-
-// Helper function from ArmPL doc example
-// https://developer.arm.com/documentation/101004/2410/Open-Random-Number-Generation--OpenRNG--Reference-Guide/Examples/skipahead-c?lang=en#skipahead-c
-void assert_ok(int err, const char *message)
-{
-  if (err != VSL_ERROR_OK)
-  {
-    fprintf(stderr, "Error: %s\n", message);
-    exit(EXIT_FAILURE);
-  }
-}
-
-
-// Function to generate Gaussian noise using ArmPL
-void gaussian_armpl(const int taille, double* noise, VSLStreamStatePtr stream)
-{
-    // assert_ok(vdRngGaussian(VSL_RNG_METHOD_GAUSSIAN_BOXMULLER2,
-    //                         stream, taille, noise, 0, 1),
-    //           "Number generation failed!");
-    vdRngGaussian(VSL_RNG_METHOD_GAUSSIAN_BOXMULLER2,
-                  stream, taille, noise, 0, 1);
-}
-
 
 // Unused
 // Function to generate Gaussian noise using Box-Muller transform
@@ -94,11 +86,15 @@ double gaussian_box_muller() {
 
 // Function to calculate the Black-Scholes call option price using
 //  Monte Carlo method
+// drift and vol are the integrated drift and standard deviation of
+//  log(ST / S0) (see integrated_drift_vol)
+// With a sketch, the payoffs are also added to it (see engines/sketch.hxx)
 double black_scholes_monte_carlo(ui64 S0, ui64 K, ui64 num_simulations,
-                                 double precomputed_stuff,
+                                 double drift, double vol,
                                  double precomputed_return,
                                  VSLStreamStatePtr stream, double* Z_tab,
-                                 double* tmpliste)
+                                 double* tmpliste,
+                                 payoff_sketch* sketch = NULL)
 {
     double sum_payoffs = 0.0;
     gaussian_armpl(num_simulations, Z_tab, stream);
@@ -178,24 +174,53 @@ double black_scholes_monte_carlo(ui64 S0, ui64 K, ui64 num_simulations,
     // }
 
     // Enhanced initial loop
-    for (ui64 i = 0; i < num_simulations; ++i)
+    if (sketch == NULL)
     {
-        double ST = (S0 * exp(precomputed_stuff * Z_tab[i])) - K;
-        double payoff = std::max(ST, 0.0);
-        sum_payoffs += payoff;
+        for (ui64 i = 0; i < num_simulations; ++i)
+        {
+            double ST = (S0 * exp(drift + vol * Z_tab[i])) - K;
+            double payoff = std::max(ST, 0.0);
+            sum_payoffs += payoff;
+        }
+        return sum_payoffs * precomputed_return;
+    }
+
+    // Same loop by blocks of stride tiles, the payoffs of the first tile
+    //  are kept in tmpliste (still in L1) for the sketch
+    ui64 block = SK_TILE * sketch->stride;
+    for (ui64 start = 0; start < num_simulations; start += block)
+    {
+        ui64 len = std::min((ui64)SK_TILE, num_simulations - start);
+        ui64 end = std::min(start + block, num_simulations);
+        for (ui64 i = 0; i < len; ++i)
+        {
+            double ST = (S0 * exp(drift + vol * Z_tab[start + i])) - K;
+            tmpliste[i] = std::max(ST, 0.0);
+            sum_payoffs += tmpliste[i];
+        }
+        sketch_add(*sketch, tmpliste, len);
+        for (ui64 i = start + len; i < end; ++i)
+        {
+            double ST = (S0 * exp(drift + vol * Z_tab[i])) - K;
+            double payoff = std::max(ST, 0.0);
+            sum_payoffs += payoff;
+        }
     }
     return sum_payoffs * precomputed_return;
 }
 
 
 int main(int argc, char* argv[]) {
-    if (argc != 3) {
-        std::cerr << "Usage: " << argv[0] << " <num_simulations> <num_runs>" << std::endl;
+    if (argc < 3 || argc > 5) {
+        std::cerr << "Usage: " << argv[0] << " <num_simulations> <num_runs> [mode] [mode argument]" << std::endl;
+        std::cerr << "Modes: call (default), multi_maturity, term_structure, payoffs, greeks, aad, path_dependent, barrier, basket, heston, merton, local_vol, american, analytic, implied_vol, pde, cos, lattice, quadrature, chebyshev, growth_index, var, sketch, payoff_dsl, plugin" << std::endl;
         return 1;
     }
 
     ui64 num_simulations = std::stoull(argv[1]);
     ui64 num_runs        = std::stoull(argv[2]);
+    std::string mode     = argc > 3 ? argv[3] : "call";
+    const char* mode_arg = argc > 4 ? argv[4] : NULL;
 
     // Input parameters
     ui64 S0      = 100;                   // Initial stock price
@@ -211,106 +236,295 @@ int main(int argc, char* argv[]) {
 
     std::cout << "Global initial seed: " << global_seed << "      argv[1]= " << argv[1] << "     argv[2]= " << argv[2] <<  std::endl;
 
-    double sum=0.0;
-    double t1=dml_micros();
+    if (mode == "multi_maturity")
+    {
+        curve r_curve     = flat_curve(r);
+        curve q_curve     = flat_curve(q);
+        curve sigma_curve = flat_curve(sigma);
+        run_multi_maturity(num_simulations, num_runs, global_seed,
+                           S0, K, r_curve, q_curve, sigma_curve);
+        free_curve(r_curve);
+        free_curve(q_curve);
+        free_curve(sigma_curve);
+        return 0;
+    }
+    else if (mode == "term_structure")
+    {
+        // Upward sloping rates, dividend step and a vol term structure
+        const double r_times[3]     = {0.25, 1.0, 2.0};
+        const double r_values[3]    = {0.04, 0.06, 0.065};
+        const double q_times[2]     = {0.5, 2.0};
+        const double q_values[2]    = {0.02, 0.035};
+        const double sigma_times[4] = {0.25, 0.5, 1.0, 2.0};
+        const double sigma_values[4] = {0.25, 0.22, 0.2, 0.19};
+        curve r_ts     = make_curve(3, r_times, r_values, CURVE_LINEAR);
+        curve q_ts     = make_curve(2, q_times, q_values,
+                                    CURVE_PIECEWISE_FLAT);
+        curve sigma_ts = make_curve(4, sigma_times, sigma_values,
+                                    CURVE_PIECEWISE_FLAT);
+        run_multi_maturity(num_simulations, num_runs, global_seed,
+                           S0, K, r_ts, q_ts, sigma_ts);
+        free_curve(r_ts);
+        free_curve(q_ts);
+        free_curve(sigma_ts);
+        return 0;
+    }
+    else if (mode == "payoffs")
+    {
+        run_payoff_set(num_simulations, num_runs, global_seed,
+                       S0, K, T, r, q, sigma);
+        return 0;
+    }
+    else if (mode == "greeks")
+    {
+        run_greeks(num_simulations, num_runs, global_seed,
+                   S0, K, T, r, q, sigma);
+        return 0;
+    }
+    else if (mode == "aad")
+    {
+        run_aad(num_simulations, num_runs, global_seed,
+                S0, K, T, r, q, sigma);
+        return 0;
+    }
+    else if (mode == "path_dependent")
+    {
+        run_path_dependent(num_simulations, num_runs, global_seed,
+                           S0, K, T, r, q, sigma);
+        return 0;
+    }
+    else if (mode == "barrier")
+    {
+        run_barrier(num_simulations, num_runs, global_seed,
+                    S0, K, T, r, q, sigma);
+        return 0;
+    }
+    else if (mode == "basket")
+    {
+        int num_assets = mode_arg ? std::stoi(mode_arg) : 10;
+        run_basket(num_simulations, num_runs, global_seed, num_assets,
+                   S0, K, T, r, q);
+        return 0;
+    }
+    else if (mode == "heston")
+    {
+        run_heston(num_simulations, num_runs, global_seed, S0, K, T, r, q);
+        return 0;
+    }
+    else if (mode == "merton")
+    {
+        run_merton(num_simulations, num_runs, global_seed,
+                   S0, K, T, r, q, sigma);
+        return 0;
+    }
+    else if (mode == "local_vol")
+    {
+        run_local_vol(num_simulations, num_runs, global_seed,
+                      S0, K, T, r, q, sigma);
+        return 0;
+    }
+    else if (mode == "american")
+    {
+        run_american(num_simulations, num_runs, global_seed,
+                     S0, K, T, r, q, sigma);
+        return 0;
+    }
+    else if (mode == "analytic")
+    {
+        run_analytic(num_simulations, num_runs, global_seed);
+        return 0;
+    }
+    else if (mode == "implied_vol")
+    {
+        run_implied_vol(num_simulations, num_runs, global_seed);
+        return 0;
+    }
+    else if (mode == "pde")
+    {
+        run_pde(num_simulations, num_runs, global_seed);
+        return 0;
+    }
+    else if (mode == "cos")
+    {
+        run_cos(num_simulations, num_runs, S0, K, T, r, q, sigma);
+        return 0;
+    }
+    else if (mode == "lattice")
+    {
+        int num_steps = mode_arg ? std::stoi(mode_arg) : 10000;
+        run_lattice(num_simulations, num_runs, global_seed, num_steps);
+        return 0;
+    }
+    else if (mode == "quadrature")
+    {
+        int num_nodes = mode_arg ? std::stoi(mode_arg) : 64;
+        run_quadrature(num_simulations, num_runs, global_seed, num_nodes);
+        return 0;
+    }
+    else if (mode == "chebyshev")
+    {
+        run_chebyshev(num_simulations, num_runs, global_seed,
+                      S0, K, T, r, q, sigma);
+        return 0;
+    }
+    else if (mode == "growth_index")
+    {
+        run_growth_index(num_simulations, num_runs, global_seed,
+                         S0, K, T, r, q, sigma);
+        return 0;
+    }
+    else if (mode == "var")
+    {
+        ui64 num_trades = mode_arg ? std::stoull(mode_arg) : 10000;
+        run_var(num_simulations, num_runs, global_seed, num_trades);
+        return 0;
+    }
+    else if (mode == "payoff_dsl")
+    {
+        run_payoff_dsl(num_simulations, num_runs, global_seed,
+                       S0, K, T, r, q, sigma, mode_arg);
+        return 0;
+    }
+    else if (mode == "plugin")
+    {
+        run_plugin(num_simulations, num_runs, global_seed,
+                   S0, K, T, r, q, sigma, black_scholes_monte_carlo);
+        return 0;
+    }
+    else if (mode != "call" && mode != "sketch")
+    {
+        std::cerr << "Unknown mode: " << mode << std::endl;
+        return 1;
+    }
 
-    // Trying to respect code compiling without -fopenmp
-    #ifdef _OPENMP
-    int num_threads;
-    #pragma omp parallel default(shared)
+    // Sketch mode: the call runs, each thread also sketches its payoffs
+    bool sketching = mode == "sketch";
+
+    // With a state file as mode argument, the runs are added to the ones of
+    //  the previous jobs (same seed, contract and number of paths)
+    estimator_state state;
+    const char* state_file = sketching ? NULL : mode_arg;
+    state_status status = state_file ? load_estimator_state(state_file, state)
+                                     : STATE_MISSING;
+    if (status == STATE_INVALID)
+    {
+        std::cerr << state_file << " exists but is not a readable estimator"
+                  << " state" << std::endl;
+        return 1;
+    }
+    if (status == STATE_LOADED)
     {
-        #pragma omp single
+        if (!estimator_state_matches(state, num_simulations, S0, K, T, r, q,
+                                     sigma))
         {
-            num_threads = omp_get_num_threads();
-            // std::cerr << "Using " << num_threads << " threads." << std::endl;
+            std::cerr << state_file << " is for another contract or number"
+                      << " of simulations" << std::endl;
+            return 1;
         }
+        global_seed = state.seed;
+        std::cout << " resuming " << state_file << ": " << state.count
+                  << " runs, seed " << global_seed << std::endl;
+    }
+    else
+    {
+        init_estimator_state(state, global_seed, num_simulations, S0, K, T,
+                             r, q, sigma);
     }
-    #endif
 
-    #ifdef _OPENMP
-    VSLStreamStatePtr parallel_streams[num_threads];
-    #else
-    VSLStreamStatePtr stream;
-    #endif
+    double sum=0.0;
+    double sum_sq=0.0;
+    double t1=dml_micros();
 
-    // VSL_BRNG_MCG59 seems faster than VSL_BRNG_MT19937.
-    // DO NOT USE VSL_BRNG_NONDETERM AS IT IS SUPER SLOW AND DISREGARDS SEED!!!
+    // One stream per thread (a single one without OpenMP)
+    int num_threads = get_num_threads();
+    VSLStreamStatePtr parallel_streams[num_threads];
 
-    #ifdef _OPENMP
-    assert_ok(vslNewStream(&parallel_streams[0], VSL_BRNG_MCG59, global_seed),
-              "vslNewStreamFailed");
-    #else
-    assert_ok(vslNewStream(&stream, VSL_BRNG_MCG59, global_seed),
-              "vslNewStreamFailed");
-    #endif
+    // "Distributing" streams on each thread
+    // Taking more in case num_threads is not a factor
+    // A resumed job starts after the numbers of the previous ones
+    ui64 skip = ((num_simulations * num_runs) / num_threads)
+                + (num_simulations * num_runs);
+    init_streams(parallel_streams, num_threads, global_seed, skip,
+                 state.offset);
 
     // This precomputing might make us lose in precision!!!
-    double precomputed_return = exp(-r * T) * (1.0 / num_simulations);
-    double precomputed_start  = (r - q - 0.5 * sigma * sigma)
-                                 * T + sigma * sqrt(T);
+    // Constant curves, the contract only needs their integrals up to T,
+    //  computed once per contract
+    curve r_curve     = flat_curve(r);
+    curve q_curve     = flat_curve(q);
+    curve sigma_curve = flat_curve(sigma);
+    double drift, vol;
+    integrated_drift_vol(r_curve, q_curve, sigma_curve, 0.0, T, &drift, &vol);
+    double discount = curve_discount(r_curve, T);
+    free_curve(r_curve);
+    free_curve(q_curve);
+    free_curve(sigma_curve);
+    double precomputed_return = discount * (1.0 / num_simulations);
+    gbm_model model   = {(double)S0, drift, vol, discount};
+    call_payoff call  = {(double)K};
+
+    // One tile of paths in stride is sketched (mode argument, 16 by default:
+    //  under 10% of the pricing loop, see engines/sketch.hxx)
+    ui64 stride = sketching && mode_arg ? std::stoull(mode_arg) : 16;
+    payoff_sketch* sketches = sketching ? alloc_sketches(num_threads, stride)
+                                        : NULL;
 
-    // "Distributing" streams on each thread
-    #ifdef _OPENMP  // Doing this part in parallel breaks things :/
-    for (ui64 i = 1; i < num_threads; ++i)
-    {
-        assert_ok(vslCopyStream(&parallel_streams[i],
-                                parallel_streams[i - 1]),
-                  "vslCopyStream");
-        // Taking more in case num_threads is not a factor
-        assert_ok(vslSkipAheadStream(parallel_streams[i],
-                                     ((num_simulations * num_runs)
-                                     / num_threads)
-                                     + (num_simulations * num_runs)),
-                  "vslSkipAhead");
-    }
-    #endif
     #pragma omp parallel default(shared)
     {
         double* Z_tab    = (double*)malloc(num_simulations * sizeof(double));
         double* tmpliste = (double*)malloc(num_simulations * sizeof(double));
-        #ifdef _OPENMP
-        int thread_rank  = omp_get_thread_num();
+        int thread_rank  = get_thread_rank();
+        payoff_sketch* sketch = sketching ? &sketches[thread_rank] : NULL;
+        openrng_sampler sampler = {parallel_streams[thread_rank]};
         double partial_sum = 0.0;
-        #endif
+        double partial_sum_sq = 0.0;
 
         #pragma omp for schedule(runtime)
         for (ui64 run = 0; run < num_runs; ++run)
         {
-            #ifdef _OPENMP
-            partial_sum += black_scholes_monte_carlo(S0, K, num_simulations,
-                                             precomputed_start,
-                                             precomputed_return,
-                                             parallel_streams[thread_rank],
-                                             Z_tab, tmpliste);
-            #else
-            sum += black_scholes_monte_carlo(S0, K, num_simulations,
-                                             precomputed_start,
-                                             precomputed_return,
-                                             stream, Z_tab, tmpliste);
-            #endif
+            // The driver of engines/pricing_api.hxx, the hand written
+            //  kernel when sketching
+            double value = sketch == NULL
+                ? price_fused(model, call, sampler, num_simulations, Z_tab)
+                : black_scholes_monte_carlo(S0, K, num_simulations,
+                                            drift, vol, precomputed_return,
+                                            parallel_streams[thread_rank],
+                                            Z_tab, tmpliste, sketch);
+            partial_sum += value;
+            partial_sum_sq += value * value;
         }
 
         // Cleaning memory
-        #ifdef _OPENMP
-        #pragma omp for schedule(static, 1)
-        for (ui64 i = 0; i < num_threads; ++i)
-        {
-            assert_ok(vslDeleteStream(&parallel_streams[i]), "vslDeleteStream");
-        }
-        #else
-        assert_ok(vslDeleteStream(&stream), "vslDeleteStream");
-        #endif
         free(Z_tab);
         free(tmpliste);
 
-        #ifdef _OPENMP
         #pragma omp atomic
         sum += partial_sum;
-        #endif
+        #pragma omp atomic
+        sum_sq += partial_sum_sq;
     }
+    delete_streams(parallel_streams, num_threads);
 
     double t2=dml_micros();
     std::cout << std::fixed << std::setprecision(6) << " value= " << sum/num_runs << " in " << (t2-t1)/1000000.0 << " seconds" << std::endl;
 
+    if (sketching)
+    {
+        for (int t = 1; t < num_threads; ++t)
+            merge_sketch(sketches[0], sketches[t]);
+        sketch_report(sketches[0], discount, S0, K, drift, vol);
+        free(sketches);
+    }
+
+    if (state_file)
+    {
+        merge_estimator_state(state, num_runs, sum, sum_sq,
+                              num_threads * skip);
+        save_estimator_state(state_file, state);
+        std::cout << " merged value= " << estimator_mean(state)
+                  << " std error= " << estimator_std_error(state) << " over "
+                  << state.count << " runs" << std::endl;
+    }
+
     return 0;
 }
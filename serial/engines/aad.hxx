@@ -0,0 +1,466 @@
+// Adjoint algorithmic differentiation (AAD) for the pricing kernels
+// The active type adouble holds AAD_LANES paths at once, every operation
+//  pushes one node (argument indices and local partials per lane) on a
+//  tape, and the reverse sweep walks the tape backwards once and gives the
+//  sensitivities to every input, whatever their number
+// The tape lives in a per thread bump allocator (arena), reset after every
+//  tile of paths so it never grows past a few kB and stays in L1
+
+#ifndef AAD_HXX
+#define AAD_HXX
+
+#include <iostream>
+#include <iomanip>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#include "mc_utils.hxx"
+#include "analytic.hxx"
+
+// Paths recorded together, the inner loops over lanes vectorize
+#define AAD_LANES 8
+
+
+// Bump allocator, everything is freed at once with arena_reset
+struct aad_arena
+{
+    char*  base;
+    size_t capacity;
+    size_t used;
+};
+
+inline void arena_init(aad_arena& arena, size_t capacity)
+{
+    arena.base     = (char*)aligned_alloc(64, capacity);
+    arena.capacity = capacity;
+    arena.used     = 0;
+}
+
+inline void* arena_alloc(aad_arena& arena, size_t bytes)
+{
+    size_t aligned = (bytes + 63) & ~(size_t)63;
+    if (arena.used + aligned > arena.capacity)
+    {
+        fprintf(stderr, "Error: AAD arena is full\n");
+        exit(EXIT_FAILURE);
+    }
+    void* ptr = arena.base + arena.used;
+    arena.used += aligned;
+    return ptr;
+}
+
+inline void arena_reset(aad_arena& arena)
+{
+    arena.used = 0;
+}
+
+inline void arena_free(aad_arena& arena)
+{
+    free(arena.base);
+    arena.base = NULL;
+}
+
+
+// One operation, at most two arguments (-1 when the argument is passive)
+struct alignas(64) aad_node
+{
+    double partial[2][AAD_LANES];
+    int    arg[2];
+};
+
+// Nodes are the only thing allocated from the arena while recording,
+//  so they are contiguous and nodes[i] is node i
+struct aad_tape
+{
+    aad_arena arena;
+    aad_node* nodes;
+    int       num_nodes;
+};
+
+// Tape the operators record on, one per thread
+inline thread_local aad_tape* aad_active_tape = NULL;
+
+inline void tape_reset(aad_tape& tape)
+{
+    arena_reset(tape.arena);
+    tape.nodes     = NULL;
+    tape.num_nodes = 0;
+}
+
+inline aad_node* tape_push(int a, int b, int& idx)
+{
+    aad_tape& tape = *aad_active_tape;
+    aad_node* node = (aad_node*)arena_alloc(tape.arena, sizeof(aad_node));
+    if (tape.nodes == NULL)
+    {
+        tape.nodes = node;
+    }
+    node->arg[0] = a;
+    node->arg[1] = b;
+    idx = tape.num_nodes++;
+    return node;
+}
+
+
+// Active type, idx is the node on the tape or -1 for a passive value
+struct adouble
+{
+    int    idx;
+    double val[AAD_LANES];
+
+    adouble() : idx(-1) {}
+
+    // Passive constant, same value on every lane
+    adouble(double c) : idx(-1)
+    {
+        for (int l = 0; l < AAD_LANES; ++l)
+            val[l] = c;
+    }
+};
+
+// New input of the computation (a leaf of the tape)
+inline adouble aad_input(double x)
+{
+    adouble z(x);
+    aad_node* node = tape_push(-1, -1, z.idx);
+    (void)node;
+    return z;
+}
+
+// Passive value that differs per lane (the normals for instance)
+inline adouble aad_lanes(const double* x)
+{
+    adouble z;
+    for (int l = 0; l < AAD_LANES; ++l)
+        z.val[l] = x[l];
+    return z;
+}
+
+
+inline adouble operator+(const adouble& x, const adouble& y)
+{
+    adouble z;
+    aad_node* node = tape_push(x.idx, y.idx, z.idx);
+    for (int l = 0; l < AAD_LANES; ++l)
+    {
+        z.val[l] = x.val[l] + y.val[l];
+        node->partial[0][l] = 1.0;
+        node->partial[1][l] = 1.0;
+    }
+    return z;
+}
+
+inline adouble operator-(const adouble& x, const adouble& y)
+{
+    adouble z;
+    aad_node* node = tape_push(x.idx, y.idx, z.idx);
+    for (int l = 0; l < AAD_LANES; ++l)
+    {
+        z.val[l] = x.val[l] - y.val[l];
+        node->partial[0][l] = 1.0;
+        node->partial[1][l] = -1.0;
+    }
+    return z;
+}
+
+inline adouble operator-(const adouble& x)
+{
+    adouble z;
+    aad_node* node = tape_push(x.idx, -1, z.idx);
+    for (int l = 0; l < AAD_LANES; ++l)
+    {
+        z.val[l] = -x.val[l];
+        node->partial[0][l] = -1.0;
+    }
+    return z;
+}
+
+inline adouble operator*(const adouble& x, const adouble& y)
+{
+    adouble z;
+    aad_node* node = tape_push(x.idx, y.idx, z.idx);
+    for (int l = 0; l < AAD_LANES; ++l)
+    {
+        z.val[l] = x.val[l] * y.val[l];
+        node->partial[0][l] = y.val[l];
+        node->partial[1][l] = x.val[l];
+    }
+    return z;
+}
+
+inline adouble operator/(const adouble& x, const adouble& y)
+{
+    adouble z;
+    aad_node* node = tape_push(x.idx, y.idx, z.idx);
+    for (int l = 0; l < AAD_LANES; ++l)
+    {
+        double inv = 1.0 / y.val[l];
+        z.val[l] = x.val[l] * inv;
+        node->partial[0][l] = inv;
+        node->partial[1][l] = -z.val[l] * inv;
+    }
+    return z;
+}
+
+inline adouble exp(const adouble& x)
+{
+    adouble z;
+    aad_node* node = tape_push(x.idx, -1, z.idx);
+    for (int l = 0; l < AAD_LANES; ++l)
+    {
+        z.val[l] = std::exp(x.val[l]);
+        node->partial[0][l] = z.val[l];
+    }
+    return z;
+}
+
+inline adouble log(const adouble& x)
+{
+    adouble z;
+    aad_node* node = tape_push(x.idx, -1, z.idx);
+    for (int l = 0; l < AAD_LANES; ++l)
+    {
+        z.val[l] = std::log(x.val[l]);
+        node->partial[0][l] = 1.0 / x.val[l];
+    }
+    return z;
+}
+
+inline adouble sqrt(const adouble& x)
+{
+    adouble z;
+    aad_node* node = tape_push(x.idx, -1, z.idx);
+    for (int l = 0; l < AAD_LANES; ++l)
+    {
+        z.val[l] = std::sqrt(x.val[l]);
+        node->partial[0][l] = 0.5 / z.val[l];
+    }
+    return z;
+}
+
+// max(x, 0), the kink of every vanilla payoff
+inline adouble max0(const adouble& x)
+{
+    adouble z;
+    aad_node* node = tape_push(x.idx, -1, z.idx);
+    for (int l = 0; l < AAD_LANES; ++l)
+    {
+        double itm = x.val[l] > 0.0 ? 1.0 : 0.0;
+        z.val[l] = itm * x.val[l];
+        node->partial[0][l] = itm;
+    }
+    return z;
+}
+
+inline double max0(double x)
+{
+    return std::max(x, 0.0);
+}
+
+
+// Reverse sweep from node output, seed[l] is the adjoint of the output on
+//  lane l (0 for padding lanes)
+// Returns the adjoints, num_nodes x AAD_LANES, allocated on the arena
+inline double* tape_reverse(aad_tape& tape, int output, const double* seed)
+{
+    double* adj = (double*)arena_alloc(tape.arena, tape.num_nodes
+                                       * AAD_LANES * sizeof(double));
+    memset(adj, 0, tape.num_nodes * AAD_LANES * sizeof(double));
+    for (int l = 0; l < AAD_LANES; ++l)
+        adj[output * AAD_LANES + l] = seed[l];
+
+    for (int n = output; n >= 0; --n)
+    {
+        const aad_node& node = tape.nodes[n];
+        const double* adj_n = adj + n * AAD_LANES;
+        for (int k = 0; k < 2; ++k)
+        {
+            if (node.arg[k] < 0)
+                continue;
+            double* adj_arg = adj + node.arg[k] * AAD_LANES;
+            for (int l = 0; l < AAD_LANES; ++l)
+                adj_arg[l] += node.partial[k][l] * adj_n[l];
+        }
+    }
+    return adj;
+}
+
+
+// The black_scholes_monte_carlo payoff, written once for double (price
+//  only) and adouble (price and every sensitivity)
+template <class Real>
+inline Real bsm_discounted_call(const Real& S0, const Real& K, const Real& T,
+                                const Real& r, const Real& q, const Real& sigma,
+                                const Real& Z)
+{
+    using std::exp;
+    using std::sqrt;
+    Real ST = S0 * exp((r - q - 0.5 * sigma * sigma) * T
+                       + sigma * sqrt(T) * Z);
+    return exp(-r * T) * max0(ST - K);
+}
+
+
+#define AAD_NUM_INPUTS 6
+
+// Adds the sum of the discounted payoffs of num_simulations paths to
+//  *sum_price, and the sum of the adjoints of (S0, K, T, r, q, sigma)
+//  to sum_adj
+inline void black_scholes_monte_carlo_aad(double S0, double K, double T,
+                                          double r, double q, double sigma,
+                                          ui64 num_simulations,
+                                          VSLStreamStatePtr stream,
+                                          double* Z_tab, aad_tape& tape,
+                                          double* sum_price, double* sum_adj)
+{
+    gaussian_armpl(num_simulations, Z_tab, stream);
+    aad_active_tape = &tape;
+
+    for (ui64 start = 0; start < num_simulations; start += AAD_LANES)
+    {
+        ui64 len = std::min((ui64)AAD_LANES, num_simulations - start);
+        double Z[AAD_LANES] = {0.0};
+        double seed[AAD_LANES] = {0.0};
+        for (ui64 l = 0; l < len; ++l)
+        {
+            Z[l]    = Z_tab[start + l];
+            seed[l] = 1.0;
+        }
+
+        tape_reset(tape);
+        adouble inputs[AAD_NUM_INPUTS] = {aad_input(S0), aad_input(K),
+                                          aad_input(T), aad_input(r),
+                                          aad_input(q), aad_input(sigma)};
+        adouble price = bsm_discounted_call(inputs[0], inputs[1], inputs[2],
+                                            inputs[3], inputs[4], inputs[5],
+                                            aad_lanes(Z));
+        double* adj = tape_reverse(tape, price.idx, seed);
+
+        for (ui64 l = 0; l < len; ++l)
+            *sum_price += price.val[l];
+        for (int k = 0; k < AAD_NUM_INPUTS; ++k)
+        {
+            const double* adj_k = adj + inputs[k].idx * AAD_LANES;
+            for (int l = 0; l < AAD_LANES; ++l)
+                sum_adj[k] += adj_k[l];
+        }
+    }
+}
+
+// Same kernel instantiated with double, the cost reference of the AAD
+inline double black_scholes_monte_carlo_plain(double S0, double K, double T,
+                                              double r, double q, double sigma,
+                                              ui64 num_simulations,
+                                              VSLStreamStatePtr stream,
+                                              double* Z_tab)
+{
+    gaussian_armpl(num_simulations, Z_tab, stream);
+    double sum_price = 0.0;
+    for (ui64 i = 0; i < num_simulations; ++i)
+    {
+        sum_price += bsm_discounted_call(S0, K, T, r, q, sigma, Z_tab[i]);
+    }
+    return sum_price;
+}
+
+
+inline void run_aad(ui64 num_simulations, ui64 num_runs,
+                    unsigned long long global_seed, double S0, double K,
+                    double T, double r, double q, double sigma)
+{
+    double sum_price = 0.0;
+    double sum_adj[AAD_NUM_INPUTS] = {0.0};
+    double sum_plain = 0.0;
+
+    int num_threads = get_num_threads();
+    VSLStreamStatePtr parallel_streams[num_threads];
+
+    // Price and sensitivities with the tape
+    double t1 = dml_micros();
+    init_streams(parallel_streams, num_threads, global_seed,
+                 num_simulations * num_runs);
+    #pragma omp parallel default(shared)
+    {
+        double* Z_tab = (double*)malloc(num_simulations * sizeof(double));
+        aad_tape tape;
+        arena_init(tape.arena, 1 << 20);
+        tape_reset(tape);
+        double partial_price = 0.0;
+        double partial_adj[AAD_NUM_INPUTS] = {0.0};
+        int thread_rank = get_thread_rank();
+
+        #pragma omp for schedule(runtime)
+        for (ui64 run = 0; run < num_runs; ++run)
+        {
+            black_scholes_monte_carlo_aad(S0, K, T, r, q, sigma,
+                                          num_simulations,
+                                          parallel_streams[thread_rank],
+                                          Z_tab, tape, &partial_price,
+                                          partial_adj);
+        }
+
+        free(Z_tab);
+        arena_free(tape.arena);
+
+        #pragma omp atomic
+        sum_price += partial_price;
+        for (int k = 0; k < AAD_NUM_INPUTS; ++k)
+        {
+            #pragma omp atomic
+            sum_adj[k] += partial_adj[k];
+        }
+    }
+    delete_streams(parallel_streams, num_threads);
+    double t2 = dml_micros();
+
+    // Price only, same streams, to measure the cost of the adjoints
+    init_streams(parallel_streams, num_threads, global_seed,
+                 num_simulations * num_runs);
+    #pragma omp parallel default(shared)
+    {
+        double* Z_tab = (double*)malloc(num_simulations * sizeof(double));
+        double partial_plain = 0.0;
+        int thread_rank = get_thread_rank();
+
+        #pragma omp for schedule(runtime)
+        for (ui64 run = 0; run < num_runs; ++run)
+        {
+            partial_plain += black_scholes_monte_carlo_plain(
+                S0, K, T, r, q, sigma, num_simulations,
+                parallel_streams[thread_rank], Z_tab);
+        }
+
+        free(Z_tab);
+
+        #pragma omp atomic
+        sum_plain += partial_plain;
+    }
+    delete_streams(parallel_streams, num_threads);
+    double t3 = dml_micros();
+
+    double N = (double)num_simulations * num_runs;
+    const char* names[AAD_NUM_INPUTS] = {"dS0", "dK", "dT", "dr", "dq",
+                                         "dsigma"};
+    const double refs[AAD_NUM_INPUTS] = {
+        call_delta(S0, K, T, r, q, sigma),
+        call_dual_delta(S0, K, T, r, q, sigma),
+        call_dT(S0, K, T, r, q, sigma),
+        call_rho(S0, K, T, r, q, sigma),
+        call_dividend_rho(S0, K, T, r, q, sigma),
+        call_vega(S0, K, T, r, q, sigma)};
+
+    std::cout << std::fixed << std::setprecision(6);
+    std::cout << " price value= " << sum_price / N << " ref= "
+              << black_scholes_call(S0, K, T, r, q, sigma) << std::endl;
+    for (int k = 0; k < AAD_NUM_INPUTS; ++k)
+    {
+        std::cout << " " << names[k] << " value= " << sum_adj[k] / N
+                  << " ref= " << refs[k] << std::endl;
+    }
+    std::cout << " aad in " << (t2-t1)/1000000.0 << " seconds, price only ("
+              << sum_plain / N << ") in " << (t3-t2)/1000000.0
+              << " seconds, ratio " << (t2-t1)/(t3-t2) << std::endl;
+}
+
+#endif
@@ -0,0 +1,314 @@
+// American mode: American put by Longstaff-Schwartz
+// Forward pass: paths are simulated tile by tile, and for each exercise
+//  date only the in-the-money states (path index, S) are kept, that's all
+//  the regression ever looks at
+// Backward pass, per date: each thread builds the basis (1, x, x^2),
+//  x = S / K, in SoA form for its ITM paths and accumulates X^T X and
+//  X^T y, the per thread sums are merged like main merges sum, the normal
+//  equations are solved with LAPACK dposv (ArmPL), then each thread updates
+//  the exercise decision of its paths
+// Each path keeps its cash flow and the date it is paid, so y is just
+//  cash * e^(-r dt (tau - d)) (no rediscounting of every path per date)
+// Validated against a CRR binomial tree
+
+#ifndef AMERICAN_HXX
+#define AMERICAN_HXX
+
+#include <iostream>
+#include <iomanip>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <limits>
+
+#include "mc_utils.hxx"
+#include "analytic.hxx"
+#include "lattice.hxx"
+
+#define LS_TILE 256
+#define LS_NUM_BASIS 3
+// Unique entries of X^T X (symmetric) followed by X^T y
+#define LS_NUM_SUMS (LS_NUM_BASIS * (LS_NUM_BASIS + 1) / 2 + LS_NUM_BASIS)
+
+
+// American put on a CRR binomial tree, the reference for the LSM price
+inline double crr_american_put(double S0, double K, double T, double r,
+                               double q, double sigma, int num_steps)
+{
+    std::vector<double> work(LATTICE_WORK_SIZE(num_steps));
+    return lattice_price(S0, K, T, r, q, sigma, -1.0, num_steps,
+                         LATTICE_AMERICAN, LATTICE_CRR, work.data());
+}
+
+
+// Solves the LS_NUM_BASIS normal equations, sums as laid out by
+//  lsm_accumulate, coefficients in beta
+inline void lsm_solve(const double* sums, double* beta)
+{
+    double A[LS_NUM_BASIS * LS_NUM_BASIS];
+    int k = 0;
+    for (int a = 0; a < LS_NUM_BASIS; ++a)
+    {
+        for (int b = a; b < LS_NUM_BASIS; ++b)
+        {
+            A[a * LS_NUM_BASIS + b] = sums[k];
+            A[b * LS_NUM_BASIS + a] = sums[k];
+            ++k;
+        }
+    }
+    for (int a = 0; a < LS_NUM_BASIS; ++a)
+        beta[a] = sums[k + a];
+
+    char uplo = 'U';
+    armpl_int_t n = LS_NUM_BASIS, nrhs = 1, info = 0;
+    dposv_(&uplo, &n, &nrhs, A, &n, beta, &n, &info);
+    if (info != 0)
+    {
+        // Not enough ITM paths at this date, never exercise
+        for (int a = 0; a < LS_NUM_BASIS; ++a)
+            beta[a] = 0.0;
+        beta[0] = std::numeric_limits<double>::max();
+    }
+}
+
+
+// State of the paths owned by one thread
+struct lsm_thread_data
+{
+    ui64 first_path;
+    ui64 num_paths;
+    std::vector<std::vector<ui64> >   itm_index;  // Per date
+    std::vector<std::vector<double> > itm_S;      // Per date
+    double* cash;       // Cash flow of each path
+    int*    tau;        // Date of the cash flow
+    double* Z_tile;
+    double* S;
+    double* x;          // Basis, SoA, one ITM date at a time
+    double* y;
+};
+
+
+// Forward pass for the paths of one thread
+inline void lsm_simulate(lsm_thread_data& td, double S0, double K,
+                         int num_dates, double drift, double vol,
+                         VSLStreamStatePtr stream)
+{
+    for (int d = 0; d < num_dates; ++d)
+    {
+        td.itm_index[d].clear();
+        td.itm_S[d].clear();
+    }
+
+    for (ui64 start = 0; start < td.num_paths; start += LS_TILE)
+    {
+        ui64 len = std::min((ui64)LS_TILE, td.num_paths - start);
+        gaussian_armpl(len * num_dates, td.Z_tile, stream);
+        for (ui64 i = 0; i < len; ++i)
+            td.S[i] = S0;
+
+        // Dates 1..num_dates, the last one is the maturity
+        for (int d = 0; d < num_dates; ++d)
+        {
+            const double* Z = td.Z_tile + d * len;
+            for (ui64 i = 0; i < len; ++i)
+                td.S[i] *= exp(drift + vol * Z[i]);
+
+            if (d == num_dates - 1)
+            {
+                for (ui64 i = 0; i < len; ++i)
+                {
+                    td.cash[start + i] = std::max(K - td.S[i], 0.0);
+                    td.tau[start + i]  = d;
+                }
+            }
+            else
+            {
+                for (ui64 i = 0; i < len; ++i)
+                {
+                    if (td.S[i] < K)
+                    {
+                        td.itm_index[d].push_back(start + i);
+                        td.itm_S[d].push_back(td.S[i]);
+                    }
+                }
+            }
+        }
+    }
+}
+
+
+// Adds the regression sums of the ITM paths of one thread at date d
+inline void lsm_accumulate(lsm_thread_data& td, int d, double K,
+                           const double* disc_pow, double* sums)
+{
+    ui64 n = td.itm_S[d].size();
+    const double* S = td.itm_S[d].data();
+    const ui64* idx = td.itm_index[d].data();
+    double inv_K = 1.0 / K;
+
+    // SoA basis and discounted cash flows
+    for (ui64 i = 0; i < n; ++i)
+    {
+        td.x[i] = S[i] * inv_K;
+        td.y[i] = td.cash[idx[i]] * disc_pow[td.tau[idx[i]] - d];
+    }
+
+    double s00 = 0.0, s01 = 0.0, s02 = 0.0, s11 = 0.0, s12 = 0.0, s22 = 0.0;
+    double b0 = 0.0, b1 = 0.0, b2 = 0.0;
+    for (ui64 i = 0; i < n; ++i)
+    {
+        double x1 = td.x[i];
+        double x2 = x1 * x1;
+        double y  = td.y[i];
+        s00 += 1.0;   s01 += x1;      s02 += x2;
+        s11 += x2;    s12 += x2 * x1; s22 += x2 * x2;
+        b0  += y;     b1  += x1 * y;  b2  += x2 * y;
+    }
+    double local[LS_NUM_SUMS] = {s00, s01, s02, s11, s12, s22, b0, b1, b2};
+    for (int k = 0; k < LS_NUM_SUMS; ++k)
+    {
+        #pragma omp atomic
+        sums[k] += local[k];
+    }
+}
+
+
+// Exercise where the payoff beats the regressed continuation value
+inline void lsm_exercise(lsm_thread_data& td, int d, double K,
+                         const double* beta)
+{
+    ui64 n = td.itm_S[d].size();
+    const double* S = td.itm_S[d].data();
+    const ui64* idx = td.itm_index[d].data();
+    double inv_K = 1.0 / K;
+    for (ui64 i = 0; i < n; ++i)
+    {
+        double x1 = S[i] * inv_K;
+        double continuation = beta[0] + x1 * (beta[1] + x1 * beta[2]);
+        double exercise = K - S[i];
+        if (exercise > continuation)
+        {
+            td.cash[idx[i]] = exercise;
+            td.tau[idx[i]]  = d;
+        }
+    }
+}
+
+
+inline void run_american(ui64 num_simulations, ui64 num_runs,
+                         unsigned long long global_seed, double S0, double K,
+                         double T, double r, double q, double sigma)
+{
+    const int num_dates = 50;
+    double dt    = T / num_dates;
+    double drift = (r - q - 0.5 * sigma * sigma) * dt;
+    double vol   = sigma * sqrt(dt);
+
+    // disc_pow[k] = e^(-r dt k), date d is at time (d + 1) dt
+    std::vector<double> disc_pow(num_dates + 1);
+    for (int k = 0; k <= num_dates; ++k)
+        disc_pow[k] = exp(-r * dt * k);
+
+    int num_threads = get_num_threads();
+    VSLStreamStatePtr parallel_streams[num_threads];
+    init_streams(parallel_streams, num_threads, global_seed,
+                 num_simulations * num_runs * num_dates);
+
+    // Paths are split in contiguous blocks, one per thread
+    std::vector<lsm_thread_data> data(num_threads);
+    ui64 chunk = (num_simulations + num_threads - 1) / num_threads;
+    for (int t = 0; t < num_threads; ++t)
+    {
+        lsm_thread_data& td = data[t];
+        td.first_path = std::min(t * chunk, num_simulations);
+        td.num_paths  = std::min(chunk, num_simulations - td.first_path);
+        td.itm_index.resize(num_dates);
+        td.itm_S.resize(num_dates);
+        td.cash   = (double*)malloc(chunk * sizeof(double));
+        td.tau    = (int*)malloc(chunk * sizeof(int));
+        td.Z_tile = (double*)malloc(LS_TILE * num_dates * sizeof(double));
+        td.S      = (double*)malloc(LS_TILE * sizeof(double));
+        td.x      = (double*)malloc(chunk * sizeof(double));
+        td.y      = (double*)malloc(chunk * sizeof(double));
+    }
+
+    double time_sim = 0.0, time_reg = 0.0, time_back = 0.0;
+    double sum = 0.0;
+    double t0 = dml_micros();
+
+    for (ui64 run = 0; run < num_runs; ++run)
+    {
+        double t1 = dml_micros();
+        #pragma omp parallel default(shared)
+        {
+            int rank = get_thread_rank();
+            lsm_simulate(data[rank], S0, K, num_dates, drift, vol,
+                         parallel_streams[rank]);
+        }
+        time_sim += dml_micros() - t1;
+
+        // Maturity is date num_dates - 1, its cash flows are already set
+        for (int d = num_dates - 2; d >= 0; --d)
+        {
+            double t2 = dml_micros();
+            double sums[LS_NUM_SUMS] = {0.0};
+            double beta[LS_NUM_BASIS];
+            #pragma omp parallel default(shared)
+            {
+                int rank = get_thread_rank();
+                lsm_accumulate(data[rank], d, K, disc_pow.data(), sums);
+            }
+            lsm_solve(sums, beta);
+            double t3 = dml_micros();
+            time_reg += t3 - t2;
+
+            #pragma omp parallel default(shared)
+            {
+                int rank = get_thread_rank();
+                lsm_exercise(data[rank], d, K, beta);
+            }
+            time_back += dml_micros() - t3;
+        }
+
+        // Discount every cash flow to today
+        double t4 = dml_micros();
+        double run_sum = 0.0;
+        #pragma omp parallel default(shared)
+        {
+            int rank = get_thread_rank();
+            lsm_thread_data& td = data[rank];
+            double partial_sum = 0.0;
+            for (ui64 i = 0; i < td.num_paths; ++i)
+                partial_sum += td.cash[i] * disc_pow[td.tau[i] + 1];
+            #pragma omp atomic
+            run_sum += partial_sum;
+        }
+        // Exercising right now is worth K - S0
+        sum += std::max(run_sum / num_simulations, K - S0);
+        time_back += dml_micros() - t4;
+    }
+    double t5 = dml_micros();
+    delete_streams(parallel_streams, num_threads);
+
+    for (int t = 0; t < num_threads; ++t)
+    {
+        free(data[t].cash);
+        free(data[t].tau);
+        free(data[t].Z_tile);
+        free(data[t].S);
+        free(data[t].x);
+        free(data[t].y);
+    }
+
+    std::cout << std::fixed << std::setprecision(6);
+    std::cout << " american_put value= " << sum / num_runs
+              << " ref= " << crr_american_put(S0, K, T, r, q, sigma, 2000)
+              << " european= " << black_scholes_put(S0, K, T, r, q, sigma)
+              << std::endl;
+    std::cout << " " << num_dates << " dates in " << (t5-t0)/1000000.0
+              << " seconds: simulation " << time_sim/1000000.0
+              << " regression " << time_reg/1000000.0
+              << " backward " << time_back/1000000.0 << std::endl;
+}
+
+#endif
@@ -0,0 +1,184 @@
+// Closed form Black-Scholes-Merton prices, used as reference values
+//  for the Monte Carlo modes
+
+#ifndef ANALYTIC_HXX
+#define ANALYTIC_HXX
+
+#include <cmath>
+
+// Standard normal cumulative distribution function
+inline double norm_cdf(double x)
+{
+    return 0.5 * std::erfc(-x * M_SQRT1_2);
+}
+
+inline double black_scholes_d1(double S0, double K, double T, double r,
+                               double q, double sigma)
+{
+    return (std::log(S0 / K) + (r - q + 0.5 * sigma * sigma) * T)
+           / (sigma * std::sqrt(T));
+}
+
+// Call price with continuous dividend yield q
+inline double black_scholes_call(double S0, double K, double T, double r,
+                                 double q, double sigma)
+{
+    double d1 = black_scholes_d1(S0, K, T, r, q, sigma);
+    double d2 = d1 - sigma * std::sqrt(T);
+    return S0 * std::exp(-q * T) * norm_cdf(d1)
+           - K * std::exp(-r * T) * norm_cdf(d2);
+}
+
+inline double black_scholes_put(double S0, double K, double T, double r,
+                                double q, double sigma)
+{
+    double d1 = black_scholes_d1(S0, K, T, r, q, sigma);
+    double d2 = d1 - sigma * std::sqrt(T);
+    return K * std::exp(-r * T) * norm_cdf(-d2)
+           - S0 * std::exp(-q * T) * norm_cdf(-d1);
+}
+
+// Pays cash if ST > K
+inline double cash_or_nothing_call(double S0, double K, double cash, double T,
+                                   double r, double q, double sigma)
+{
+    double d2 = black_scholes_d1(S0, K, T, r, q, sigma) - sigma * std::sqrt(T);
+    return cash * std::exp(-r * T) * norm_cdf(d2);
+}
+
+// Pays ST if ST > K
+inline double asset_or_nothing_call(double S0, double K, double T, double r,
+                                    double q, double sigma)
+{
+    double d1 = black_scholes_d1(S0, K, T, r, q, sigma);
+    return S0 * std::exp(-q * T) * norm_cdf(d1);
+}
+
+// Pays ST - K
+inline double forward_value(double S0, double K, double T, double r, double q)
+{
+    return S0 * std::exp(-q * T) - K * std::exp(-r * T);
+}
+
+
+// Greeks of the call, used to check the Monte Carlo estimators
+inline double norm_pdf(double x)
+{
+    return 0.3989422804014327 * std::exp(-0.5 * x * x);
+}
+
+inline double call_delta(double S0, double K, double T, double r, double q,
+                         double sigma)
+{
+    return std::exp(-q * T) * norm_cdf(black_scholes_d1(S0, K, T, r, q, sigma));
+}
+
+inline double call_gamma(double S0, double K, double T, double r, double q,
+                         double sigma)
+{
+    double d1 = black_scholes_d1(S0, K, T, r, q, sigma);
+    return std::exp(-q * T) * norm_pdf(d1) / (S0 * sigma * std::sqrt(T));
+}
+
+inline double call_vega(double S0, double K, double T, double r, double q,
+                        double sigma)
+{
+    double d1 = black_scholes_d1(S0, K, T, r, q, sigma);
+    return S0 * std::exp(-q * T) * norm_pdf(d1) * std::sqrt(T);
+}
+
+inline double call_rho(double S0, double K, double T, double r, double q,
+                       double sigma)
+{
+    double d2 = black_scholes_d1(S0, K, T, r, q, sigma) - sigma * std::sqrt(T);
+    return K * T * std::exp(-r * T) * norm_cdf(d2);
+}
+
+// Sensitivity of the call to the dividend yield
+inline double call_dividend_rho(double S0, double K, double T, double r,
+                                double q, double sigma)
+{
+    return -T * S0 * std::exp(-q * T)
+           * norm_cdf(black_scholes_d1(S0, K, T, r, q, sigma));
+}
+
+// Sensitivity of the call to the strike
+inline double call_dual_delta(double S0, double K, double T, double r,
+                              double q, double sigma)
+{
+    double d2 = black_scholes_d1(S0, K, T, r, q, sigma) - sigma * std::sqrt(T);
+    return -std::exp(-r * T) * norm_cdf(d2);
+}
+
+// Sensitivity of the call to the maturity (minus the theta)
+inline double call_dT(double S0, double K, double T, double r, double q,
+                      double sigma)
+{
+    double d1 = black_scholes_d1(S0, K, T, r, q, sigma);
+    double d2 = d1 - sigma * std::sqrt(T);
+    return S0 * std::exp(-q * T) * norm_pdf(d1) * sigma / (2.0 * std::sqrt(T))
+           - q * S0 * std::exp(-q * T) * norm_cdf(d1)
+           + r * K * std::exp(-r * T) * norm_cdf(d2);
+}
+
+// Delta of the cash-or-nothing call paying 1
+inline double digital_delta(double S0, double K, double T, double r, double q,
+                            double sigma)
+{
+    double d2 = black_scholes_d1(S0, K, T, r, q, sigma) - sigma * std::sqrt(T);
+    return std::exp(-r * T) * norm_pdf(d2) / (S0 * sigma * std::sqrt(T));
+}
+
+// Delta of the asset-or-nothing call
+inline double asset_or_nothing_delta(double S0, double K, double T, double r,
+                                     double q, double sigma)
+{
+    double d1 = black_scholes_d1(S0, K, T, r, q, sigma);
+    return std::exp(-q * T)
+           * (norm_cdf(d1) + norm_pdf(d1) / (sigma * std::sqrt(T)));
+}
+
+// Continuously monitored knock-out calls without rebate (Haug's notation)
+// phi = 1 for calls, eta = 1 for down barriers and -1 for up barriers
+inline void barrier_terms(double S0, double K, double H, double T, double r,
+                          double q, double sigma, double eta, double* A,
+                          double* B, double* C, double* D)
+{
+    double vol_sqrt_T = sigma * std::sqrt(T);
+    double mu  = (r - q - 0.5 * sigma * sigma) / (sigma * sigma);
+    double x1  = std::log(S0 / K) / vol_sqrt_T + (1.0 + mu) * vol_sqrt_T;
+    double x2  = std::log(S0 / H) / vol_sqrt_T + (1.0 + mu) * vol_sqrt_T;
+    double y1  = std::log(H * H / (S0 * K)) / vol_sqrt_T
+                 + (1.0 + mu) * vol_sqrt_T;
+    double y2  = std::log(H / S0) / vol_sqrt_T + (1.0 + mu) * vol_sqrt_T;
+    double fwd = S0 * std::exp(-q * T);
+    double df  = K * std::exp(-r * T);
+    double hs1 = std::pow(H / S0, 2.0 * (mu + 1.0));
+    double hs2 = std::pow(H / S0, 2.0 * mu);
+    *A = fwd * norm_cdf(x1) - df * norm_cdf(x1 - vol_sqrt_T);
+    *B = fwd * norm_cdf(x2) - df * norm_cdf(x2 - vol_sqrt_T);
+    *C = fwd * hs1 * norm_cdf(eta * y1)
+         - df * hs2 * norm_cdf(eta * y1 - eta * vol_sqrt_T);
+    *D = fwd * hs1 * norm_cdf(eta * y2)
+         - df * hs2 * norm_cdf(eta * y2 - eta * vol_sqrt_T);
+}
+
+// Dies if S goes below H < S0
+inline double down_and_out_call(double S0, double K, double H, double T,
+                                double r, double q, double sigma)
+{
+    double A, B, C, D;
+    barrier_terms(S0, K, H, T, r, q, sigma, 1.0, &A, &B, &C, &D);
+    return K > H ? A - C : B - D;
+}
+
+// Dies if S goes above H > S0
+inline double up_and_out_call(double S0, double K, double H, double T,
+                              double r, double q, double sigma)
+{
+    double A, B, C, D;
+    barrier_terms(S0, K, H, T, r, q, sigma, -1.0, &A, &B, &C, &D);
+    return K > H ? 0.0 : A - B + C - D;
+}
+
+#endif
@@ -0,0 +1,240 @@
+// Analytic mode: closed form BSM prices and Greeks for large batches of
+//  contracts
+// Contracts are given as SoA arrays (S, K, T, r, q, sigma, cp with cp = 1
+//  for a call and -1 for a put), the per contract formula is inlined in an
+//  "omp parallel for simd" loop so log, exp and erfc go through the vector
+//  math library (libamath) and the batch is split across the threads
+// The scalar functions of analytic.hxx stay the references of the Monte
+//  Carlo modes, the batch prices are checked against them and the Greeks
+//  against central finite differences of the scalar prices
+
+#ifndef ANALYTIC_BATCH_HXX
+#define ANALYTIC_BATCH_HXX
+
+#include <iostream>
+#include <iomanip>
+#include <cmath>
+#include <algorithm>
+
+#include "mc_utils.hxx"
+#include "analytic.hxx"
+
+// SoA batch of European options
+struct contract_batch
+{
+    ui64    n;
+    double* S;
+    double* K;
+    double* T;
+    double* r;
+    double* q;
+    double* sigma;
+    double* cp;         // 1 call, -1 put
+};
+
+// Outputs, theta is per year (dV/dt = -dV/dT)
+struct greeks_batch
+{
+    double* price;
+    double* delta;
+    double* gamma;
+    double* vega;
+    double* theta;
+    double* rho;
+};
+
+
+inline contract_batch alloc_contracts(ui64 n)
+{
+    contract_batch c;
+    c.n     = n;
+    c.S     = (double*)malloc(n * sizeof(double));
+    c.K     = (double*)malloc(n * sizeof(double));
+    c.T     = (double*)malloc(n * sizeof(double));
+    c.r     = (double*)malloc(n * sizeof(double));
+    c.q     = (double*)malloc(n * sizeof(double));
+    c.sigma = (double*)malloc(n * sizeof(double));
+    c.cp    = (double*)malloc(n * sizeof(double));
+    return c;
+}
+
+inline void free_contracts(contract_batch& c)
+{
+    free(c.S);
+    free(c.K);
+    free(c.T);
+    free(c.r);
+    free(c.q);
+    free(c.sigma);
+    free(c.cp);
+}
+
+inline greeks_batch alloc_greeks(ui64 n)
+{
+    greeks_batch g;
+    g.price = (double*)malloc(n * sizeof(double));
+    g.delta = (double*)malloc(n * sizeof(double));
+    g.gamma = (double*)malloc(n * sizeof(double));
+    g.vega  = (double*)malloc(n * sizeof(double));
+    g.theta = (double*)malloc(n * sizeof(double));
+    g.rho   = (double*)malloc(n * sizeof(double));
+    return g;
+}
+
+inline void free_greeks(greeks_batch& g)
+{
+    free(g.price);
+    free(g.delta);
+    free(g.gamma);
+    free(g.vega);
+    free(g.theta);
+    free(g.rho);
+}
+
+
+// Price and Greeks of the whole batch
+inline void black_scholes_batch(const contract_batch& c, const greeks_batch& g)
+{
+    const ui64 n = c.n;
+    #pragma omp parallel for simd schedule(static)
+    for (ui64 i = 0; i < n; ++i)
+    {
+        double S = c.S[i], K = c.K[i], T = c.T[i];
+        double r = c.r[i], q = c.q[i], sigma = c.sigma[i], cp = c.cp[i];
+
+        double sqrt_T  = sqrt(T);
+        double vol     = sigma * sqrt_T;
+        double d1      = (log(S / K) + (r - q + 0.5 * sigma * sigma) * T)
+                         / vol;
+        double d2      = d1 - vol;
+        double fwd     = S * exp(-q * T);
+        double df      = K * exp(-r * T);
+        double N1      = 0.5 * erfc(-cp * d1 * M_SQRT1_2);     // N(cp d1)
+        double N2      = 0.5 * erfc(-cp * d2 * M_SQRT1_2);     // N(cp d2)
+        double pdf1    = 0.3989422804014327 * exp(-0.5 * d1 * d1);
+
+        g.price[i] = cp * (fwd * N1 - df * N2);
+        g.delta[i] = cp * exp(-q * T) * N1;
+        g.gamma[i] = fwd * pdf1 / (S * S * vol);
+        g.vega[i]  = fwd * pdf1 * sqrt_T;
+        g.theta[i] = -fwd * pdf1 * sigma / (2.0 * sqrt_T)
+                     - cp * r * df * N2 + cp * q * fwd * N1;
+        g.rho[i]   = cp * df * T * N2;
+    }
+}
+
+
+// Random contracts around S = 100, every thread fills its own slice with
+//  its own stream, offset numbers into the stream of global_seed (uses at
+//  most num_threads * 7 * c.n numbers)
+inline void random_contracts(contract_batch& c, unsigned long long global_seed,
+                             ui64 offset = 0)
+{
+    int num_threads = get_num_threads();
+    VSLStreamStatePtr parallel_streams[num_threads];
+    init_streams(parallel_streams, num_threads, global_seed, 7 * c.n, offset);
+
+    #pragma omp parallel default(shared)
+    {
+        int rank   = get_thread_rank();
+        ui64 chunk = (c.n + num_threads - 1) / num_threads;
+        ui64 first = std::min(rank * chunk, c.n);
+        ui64 len   = std::min(chunk, c.n - first);
+        VSLStreamStatePtr stream = parallel_streams[rank];
+
+        uniform_armpl(len, c.S + first, stream);
+        uniform_armpl(len, c.K + first, stream);
+        uniform_armpl(len, c.T + first, stream);
+        uniform_armpl(len, c.r + first, stream);
+        uniform_armpl(len, c.q + first, stream);
+        uniform_armpl(len, c.sigma + first, stream);
+        uniform_armpl(len, c.cp + first, stream);
+        for (ui64 i = first; i < first + len; ++i)
+        {
+            c.S[i]     = 80.0 + 40.0 * c.S[i];
+            c.K[i]     = 60.0 + 80.0 * c.K[i];
+            c.T[i]     = 0.05 + 2.95 * c.T[i];
+            c.r[i]     = 0.08 * c.r[i];
+            c.q[i]     = 0.04 * c.q[i];
+            c.sigma[i] = 0.1 + 0.5 * c.sigma[i];
+            c.cp[i]    = c.cp[i] < 0.5 ? 1.0 : -1.0;
+        }
+    }
+    delete_streams(parallel_streams, num_threads);
+}
+
+
+// Scalar price of contract i with S, T, r and sigma replaced (bumped)
+inline double scalar_price(const contract_batch& c, ui64 i, double S,
+                           double T, double r, double sigma)
+{
+    return c.cp[i] > 0.0
+        ? black_scholes_call(S, c.K[i], T, r, c.q[i], sigma)
+        : black_scholes_put(S, c.K[i], T, r, c.q[i], sigma);
+}
+
+
+// num_simulations contracts priced num_runs times
+inline void run_analytic(ui64 num_simulations, ui64 num_runs,
+                         unsigned long long global_seed)
+{
+    contract_batch c = alloc_contracts(num_simulations);
+    greeks_batch g   = alloc_greeks(num_simulations);
+    random_contracts(c, global_seed);
+
+    double t1 = dml_micros();
+    for (ui64 run = 0; run < num_runs; ++run)
+    {
+        black_scholes_batch(c, g);
+    }
+    double t2 = dml_micros();
+
+    // Prices against the scalar formulas, Greeks against central
+    //  differences of the scalar prices (bumps of 1e-4 relative for S, 1e-5
+    //  absolute for T, r and sigma, short maturities dominate the error)
+    const ui64 num_checked = std::min(c.n, (ui64)100000);
+    double max_error[6] = {0.0};
+    double sum = 0.0;
+    for (ui64 i = 0; i < c.n; ++i)
+        sum += g.price[i];
+    for (ui64 i = 0; i < num_checked; ++i)
+    {
+        double S = c.S[i], T = c.T[i], r = c.r[i], sigma = c.sigma[i];
+        double hS = 1e-4 * S, h = 1e-5;
+        double V  = scalar_price(c, i, S, T, r, sigma);
+        double Vu = scalar_price(c, i, S + hS, T, r, sigma);
+        double Vd = scalar_price(c, i, S - hS, T, r, sigma);
+        double ref[6] = {
+            V,
+            (Vu - Vd) / (2.0 * hS),
+            (Vu - 2.0 * V + Vd) / (hS * hS),
+            (scalar_price(c, i, S, T, r, sigma + h)
+             - scalar_price(c, i, S, T, r, sigma - h)) / (2.0 * h),
+            -(scalar_price(c, i, S, T + h, r, sigma)
+              - scalar_price(c, i, S, T - h, r, sigma)) / (2.0 * h),
+            (scalar_price(c, i, S, T, r + h, sigma)
+             - scalar_price(c, i, S, T, r - h, sigma)) / (2.0 * h)};
+        double batch[6] = {g.price[i], g.delta[i], g.gamma[i], g.vega[i],
+                           g.theta[i], g.rho[i]};
+        for (int k = 0; k < 6; ++k)
+            max_error[k] = std::max(max_error[k], fabs(batch[k] - ref[k]));
+    }
+
+    double seconds = (t2 - t1) / 1000000.0;
+    std::cout << std::fixed << std::setprecision(6);
+    std::cout << " mean price= " << sum / c.n << ", max error on "
+              << num_checked << " contracts: price= " << std::scientific
+              << std::setprecision(3) << max_error[0] << " (scalar), delta= "
+              << max_error[1] << " gamma= " << max_error[2] << " vega= "
+              << max_error[3] << " theta= " << max_error[4] << " rho= "
+              << max_error[5] << " (finite differences)" << std::fixed
+              << std::setprecision(6) << std::endl;
+    std::cout << " " << c.n * num_runs << " contracts in " << seconds
+              << " seconds, " << c.n * num_runs / seconds
+              << " contracts/s" << std::endl;
+
+    free_contracts(c);
+    free_greeks(g);
+}
+
+#endif
@@ -0,0 +1,192 @@
+// Barrier mode: knock-out calls on a continuously monitored barrier with a
+//  few dozen time steps
+// Between two steps the path is a Brownian bridge, it crossed the barrier
+//  b (in log) with probability exp(-2 (x_i - b) (x_i+1 - b) / (sigma^2 dt)),
+//  so instead of checking the barrier on the grid only, each path carries
+//  its survival probability (weight) and we multiply it by 1 - p each step
+// Dead paths (crossed on the grid or with a negligible weight) are
+//  compacted out of the tile, so they stop asking for normals and exp
+// Knock-in prices come from the in-out parity with the analytic vanilla
+
+#ifndef BARRIER_HXX
+#define BARRIER_HXX
+
+#include <iostream>
+#include <iomanip>
+#include <cmath>
+#include <algorithm>
+
+#include "mc_utils.hxx"
+#include "analytic.hxx"
+
+#define BA_TILE 256
+
+// Below this survival probability a path is considered knocked out
+#define BA_EPS 1e-9
+
+
+// Adds the undiscounted sum of the knock-out call payoffs of
+//  num_simulations paths to *sum, and the number of normals drawn
+//  to *work
+// direction = 1 for a down barrier (alive while S > H), -1 for an up one
+// Without bridge the barrier is only checked on the time grid
+// Z, log_S and weight must hold BA_TILE doubles
+inline void barrier_monte_carlo(double S0, double K, double H, double direction,
+                                int num_steps, double drift, double vol,
+                                bool bridge, ui64 num_simulations,
+                                VSLStreamStatePtr stream, double* Z,
+                                double* log_S, double* weight, double* sum,
+                                double* work)
+{
+    double log_S0 = log(S0);
+    double log_H  = log(H);
+    double inv_var = 2.0 / (vol * vol);
+    double sum_payoffs = 0.0;
+    ui64 normals = 0;
+
+    for (ui64 start = 0; start < num_simulations; start += BA_TILE)
+    {
+        ui64 alive = std::min((ui64)BA_TILE, num_simulations - start);
+        for (ui64 i = 0; i < alive; ++i)
+        {
+            log_S[i]  = log_S0;
+            weight[i] = 1.0;
+        }
+
+        for (int t = 0; t < num_steps && alive > 0; ++t)
+        {
+            gaussian_armpl(alive, Z, stream);
+            normals += alive;
+
+            for (ui64 i = 0; i < alive; ++i)
+            {
+                double x      = log_S[i] + drift + vol * Z[i];
+                double d_old  = direction * (log_S[i] - log_H);
+                double d_new  = direction * (x - log_H);
+                // p = 1 when the grid point itself is past the barrier
+                double p      = exp(-inv_var * d_old * std::max(d_new, 0.0));
+                double keep   = bridge ? 1.0 - p : (d_new > 0.0 ? 1.0 : 0.0);
+                weight[i]    *= keep;
+                log_S[i]      = x;
+            }
+
+            // Branch free compaction of the surviving lanes
+            ui64 k = 0;
+            for (ui64 i = 0; i < alive; ++i)
+            {
+                log_S[k]  = log_S[i];
+                weight[k] = weight[i];
+                k += weight[i] > BA_EPS ? 1 : 0;
+            }
+            alive = k;
+        }
+
+        for (ui64 i = 0; i < alive; ++i)
+        {
+            sum_payoffs += weight[i] * std::max(S0 * exp(log_S[i] - log_S0)
+                                                - K, 0.0);
+        }
+    }
+
+    *sum  += sum_payoffs;
+    *work += normals;
+}
+
+
+// Prices one knock-out call over num_runs runs, returns the price and
+//  puts the fraction of the normals a non compacted engine would draw
+//  in *work_fraction
+inline double price_barrier(ui64 num_simulations, ui64 num_runs,
+                            unsigned long long global_seed, double S0, double K,
+                            double H, double direction, int num_steps, double T,
+                            double r, double q, double sigma, bool bridge,
+                            double* work_fraction)
+{
+    double dt    = T / num_steps;
+    double drift = (r - q - 0.5 * sigma * sigma) * dt;
+    double vol   = sigma * sqrt(dt);
+
+    double sum  = 0.0;
+    double work = 0.0;
+
+    int num_threads = get_num_threads();
+    VSLStreamStatePtr parallel_streams[num_threads];
+    init_streams(parallel_streams, num_threads, global_seed,
+                 num_simulations * num_runs * num_steps);
+
+    #pragma omp parallel default(shared)
+    {
+        double* Z      = (double*)malloc(BA_TILE * sizeof(double));
+        double* log_S  = (double*)malloc(BA_TILE * sizeof(double));
+        double* weight = (double*)malloc(BA_TILE * sizeof(double));
+        double partial_sum  = 0.0;
+        double partial_work = 0.0;
+        int thread_rank = get_thread_rank();
+
+        #pragma omp for schedule(runtime)
+        for (ui64 run = 0; run < num_runs; ++run)
+        {
+            barrier_monte_carlo(S0, K, H, direction, num_steps, drift, vol,
+                                bridge, num_simulations,
+                                parallel_streams[thread_rank], Z, log_S,
+                                weight, &partial_sum, &partial_work);
+        }
+
+        free(Z);
+        free(log_S);
+        free(weight);
+
+        #pragma omp atomic
+        sum += partial_sum;
+        #pragma omp atomic
+        work += partial_work;
+    }
+    delete_streams(parallel_streams, num_threads);
+
+    double N = (double)num_simulations * num_runs;
+    *work_fraction = work / (N * num_steps);
+    return exp(-r * T) * sum / N;
+}
+
+
+inline void run_barrier(ui64 num_simulations, ui64 num_runs,
+                        unsigned long long global_seed, double S0, double K,
+                        double T, double r, double q, double sigma)
+{
+    const int num_steps = 32;
+    const double H_down = 90.0;
+    const double H_up   = 130.0;
+
+    double vanilla = black_scholes_call(S0, K, T, r, q, sigma);
+    double refs[2] = {down_and_out_call(S0, K, H_down, T, r, q, sigma),
+                      up_and_out_call(S0, K, H_up, T, r, q, sigma)};
+    const char* names[2] = {"down_and_out", "up_and_out"};
+    const char* in_names[2] = {"down_and_in", "up_and_in"};
+    double levels[2]     = {H_down, H_up};
+    double directions[2] = {1.0, -1.0};
+
+    std::cout << std::fixed << std::setprecision(6);
+    double t1 = dml_micros();
+    for (int b = 0; b < 2; ++b)
+    {
+        double work, work_discrete;
+        double value = price_barrier(num_simulations, num_runs, global_seed,
+                                     S0, K, levels[b], directions[b],
+                                     num_steps, T, r, q, sigma, true, &work);
+        double discrete = price_barrier(num_simulations, num_runs,
+                                        global_seed, S0, K, levels[b],
+                                        directions[b], num_steps, T, r, q,
+                                        sigma, false, &work_discrete);
+        std::cout << " " << names[b] << " H= " << levels[b]
+                  << " value= " << value << " no_bridge= " << discrete
+                  << " ref= " << refs[b] << " work= " << work << std::endl;
+        std::cout << " " << in_names[b] << " H= " << levels[b]
+                  << " value= " << vanilla - value
+                  << " ref= " << vanilla - refs[b] << std::endl;
+    }
+    double t2 = dml_micros();
+    std::cout << " " << num_steps << " steps in " << (t2-t1)/1000000.0
+              << " seconds" << std::endl;
+}
+
+#endif
@@ -0,0 +1,236 @@
+// Basket mode: calls on a basket, best-of and worst-of N correlated
+//  underlyings (GBM, constant correlation)
+// For a tile of paths the N_assets x BK_TILE independent normals are
+//  correlated with one dgemm by the Cholesky factor of the correlation
+//  matrix (ArmPL BLAS), then the payoffs loop over assets (outer) and paths
+//  (inner) so the running sum, min and max vectorize
+// The geometric basket call has a closed form and checks the whole chain
+
+#ifndef BASKET_HXX
+#define BASKET_HXX
+
+#include <iostream>
+#include <iomanip>
+#include <cmath>
+#include <algorithm>
+#include <limits>
+
+#include "mc_utils.hxx"
+#include "analytic.hxx"
+
+#define BK_TILE 256
+
+#define BK_NUM_PRODUCTS 4
+#define BK_BASKET  0    // (sum w_a S_a - K)+
+#define BK_BEST    1    // (max S_a - K)+
+#define BK_WORST   2    // (min S_a - K)+
+#define BK_GEO     3    // (prod S_a^w_a - K)+
+
+const char* const bk_names[BK_NUM_PRODUCTS] = {"basket", "best_of",
+                                               "worst_of",
+                                               "geometric_basket"};
+
+
+// Lower Cholesky factor of the n x n (row-major) matrix A
+inline void cholesky_lower(const double* A, double* L, int n)
+{
+    for (int i = 0; i < n * n; ++i)
+        L[i] = 0.0;
+    for (int j = 0; j < n; ++j)
+    {
+        double d = A[j * n + j];
+        for (int k = 0; k < j; ++k)
+            d -= L[j * n + k] * L[j * n + k];
+        if (d <= 0.0)
+        {
+            fprintf(stderr, "Error: correlation matrix is not positive definite\n");
+            exit(EXIT_FAILURE);
+        }
+        L[j * n + j] = sqrt(d);
+        for (int i = j + 1; i < n; ++i)
+        {
+            double s = A[i * n + j];
+            for (int k = 0; k < j; ++k)
+                s -= L[i * n + k] * L[j * n + k];
+            L[i * n + j] = s / L[j * n + j];
+        }
+    }
+}
+
+
+// Adds the undiscounted payoff sums of num_simulations paths to sums
+// L is the Cholesky factor of the correlation, log_S0[a] + drift[a] and
+//  vol[a] the mean and standard deviation of log S_a(T)
+// Z and W must hold num_assets * BK_TILE doubles, basket, best, worst and
+//  geo BK_TILE doubles each (one block of 4 * BK_TILE in acc)
+inline void basket_monte_carlo(int num_assets, const double* L,
+                               const double* log_S0, const double* drift,
+                               const double* vol, const double* weights,
+                               double K, ui64 num_simulations,
+                               VSLStreamStatePtr stream, double* Z, double* W,
+                               double* acc, double* sums)
+{
+    double* basket = acc;
+    double* best   = acc + BK_TILE;
+    double* worst  = acc + 2 * BK_TILE;
+    double* geo    = acc + 3 * BK_TILE;
+
+    for (ui64 start = 0; start < num_simulations; start += BK_TILE)
+    {
+        ui64 len = std::min((ui64)BK_TILE, num_simulations - start);
+        gaussian_armpl(num_assets * len, Z, stream);
+
+        // W = L Z, (n x n) x (n x len)
+        cblas_dgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans,
+                    num_assets, len, num_assets, 1.0, L, num_assets,
+                    Z, len, 0.0, W, len);
+
+        for (ui64 i = 0; i < len; ++i)
+        {
+            basket[i] = 0.0;
+            best[i]   = 0.0;
+            worst[i]  = std::numeric_limits<double>::max();
+            geo[i]    = 0.0;
+        }
+        for (int a = 0; a < num_assets; ++a)
+        {
+            const double* W_a = W + a * len;
+            double m = log_S0[a] + drift[a];
+            double v = vol[a];
+            double w = weights[a];
+            for (ui64 i = 0; i < len; ++i)
+            {
+                double x  = m + v * W_a[i];
+                double S  = exp(x);
+                basket[i] += w * S;
+                geo[i]    += w * x;
+                best[i]    = std::max(best[i], S);
+                worst[i]   = std::min(worst[i], S);
+            }
+        }
+
+        double s[BK_NUM_PRODUCTS] = {0.0};
+        for (ui64 i = 0; i < len; ++i)
+        {
+            s[BK_BASKET] += std::max(basket[i] - K, 0.0);
+            s[BK_BEST]   += std::max(best[i] - K, 0.0);
+            s[BK_WORST]  += std::max(worst[i] - K, 0.0);
+            s[BK_GEO]    += std::max(exp(geo[i]) - K, 0.0);
+        }
+        for (int k = 0; k < BK_NUM_PRODUCTS; ++k)
+            sums[k] += s[k];
+    }
+}
+
+
+// num_assets comes from the optional mode argument (default 10)
+inline void run_basket(ui64 num_simulations, ui64 num_runs,
+                       unsigned long long global_seed, int num_assets,
+                       double S0, double K, double T, double r, double q)
+{
+    const double rho = 0.5;     // Same correlation for every pair
+    if (num_assets < 1)
+    {
+        fprintf(stderr, "Error: the basket needs at least one asset\n");
+        exit(EXIT_FAILURE);
+    }
+
+    double* corr    = (double*)malloc(num_assets * num_assets * sizeof(double));
+    double* L       = (double*)malloc(num_assets * num_assets * sizeof(double));
+    double* log_S0  = (double*)malloc(num_assets * sizeof(double));
+    double* drift   = (double*)malloc(num_assets * sizeof(double));
+    double* vol     = (double*)malloc(num_assets * sizeof(double));
+    double* sigmas  = (double*)malloc(num_assets * sizeof(double));
+    double* weights = (double*)malloc(num_assets * sizeof(double));
+
+    // Volatilities spread between 15% and 35%, equal weights
+    for (int a = 0; a < num_assets; ++a)
+    {
+        sigmas[a]  = 0.15 + 0.2 * a / std::max(num_assets - 1, 1);
+        log_S0[a]  = log(S0);
+        drift[a]   = (r - q - 0.5 * sigmas[a] * sigmas[a]) * T;
+        vol[a]     = sigmas[a] * sqrt(T);
+        weights[a] = 1.0 / num_assets;
+        for (int b = 0; b < num_assets; ++b)
+            corr[a * num_assets + b] = a == b ? 1.0 : rho;
+    }
+    cholesky_lower(corr, L, num_assets);
+
+    // log of the geometric basket is normal
+    double geo_mean = 0.0, geo_var = 0.0;
+    for (int a = 0; a < num_assets; ++a)
+    {
+        geo_mean += weights[a] * (log_S0[a] + drift[a]);
+        for (int b = 0; b < num_assets; ++b)
+            geo_var += weights[a] * weights[b] * vol[a] * vol[b]
+                       * corr[a * num_assets + b];
+    }
+    double geo_sd  = sqrt(geo_var);
+    double geo_d1  = (geo_mean - log(K) + geo_var) / geo_sd;
+    double geo_ref = exp(-r * T) * (exp(geo_mean + 0.5 * geo_var)
+                                    * norm_cdf(geo_d1)
+                                    - K * norm_cdf(geo_d1 - geo_sd));
+
+    double sums[BK_NUM_PRODUCTS] = {0.0};
+    double t1 = dml_micros();
+
+    int num_threads = get_num_threads();
+    VSLStreamStatePtr parallel_streams[num_threads];
+    init_streams(parallel_streams, num_threads, global_seed,
+                 num_simulations * num_runs * num_assets);
+
+    #pragma omp parallel default(shared)
+    {
+        double* Z   = (double*)malloc(num_assets * BK_TILE * sizeof(double));
+        double* W   = (double*)malloc(num_assets * BK_TILE * sizeof(double));
+        double* acc = (double*)malloc(4 * BK_TILE * sizeof(double));
+        double partial_sums[BK_NUM_PRODUCTS] = {0.0};
+        int thread_rank = get_thread_rank();
+
+        #pragma omp for schedule(runtime)
+        for (ui64 run = 0; run < num_runs; ++run)
+        {
+            basket_monte_carlo(num_assets, L, log_S0, drift, vol, weights, K,
+                               num_simulations,
+                               parallel_streams[thread_rank], Z, W, acc,
+                               partial_sums);
+        }
+
+        free(Z);
+        free(W);
+        free(acc);
+
+        for (int k = 0; k < BK_NUM_PRODUCTS; ++k)
+        {
+            #pragma omp atomic
+            sums[k] += partial_sums[k];
+        }
+    }
+    delete_streams(parallel_streams, num_threads);
+
+    double t2 = dml_micros();
+    double N  = (double)num_simulations * num_runs;
+
+    std::cout << std::fixed << std::setprecision(6);
+    for (int k = 0; k < BK_NUM_PRODUCTS; ++k)
+    {
+        std::cout << " " << bk_names[k] << " value= "
+                  << exp(-r * T) * sums[k] / N;
+        if (k == BK_GEO)
+            std::cout << " ref= " << geo_ref;
+        std::cout << std::endl;
+    }
+    std::cout << " " << num_assets << " assets in " << (t2-t1)/1000000.0
+              << " seconds, " << N * num_assets / ((t2-t1)/1000000.0)
+              << " asset-paths/s" << std::endl;
+
+    free(corr);
+    free(L);
+    free(log_S0);
+    free(drift);
+    free(vol);
+    free(sigmas);
+    free(weights);
+}
+
+#endif
@@ -0,0 +1,129 @@
+// Estimator state of the call mode, saved after a job so a later job can
+//  add runs instead of starting over
+// The state keeps the count, sum and sum of squares of the run values (the
+//  per run estimates are i.i.d., their spread gives the standard error),
+//  the seed, the contract (a state is only resumed for the same one) and
+//  the offset of the first normal no job has used yet
+// Random numbers are addressed by that counter offset rather than by a
+//  vslSaveStreamF image: a resumed job skips stream 0 ahead to the offset
+//  and lays its per thread streams out from there, so the jobs draw from
+//  disjoint substreams whatever their thread counts
+// The file is written next to its destination then renamed, a job killed
+//  while saving leaves the previous state intact
+
+#ifndef CHECKPOINT_HXX
+#define CHECKPOINT_HXX
+
+#include <cstdio>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <algorithm>
+
+#include "mc_utils.hxx"
+
+#define ESTIMATOR_STATE_MAGIC 0x42534d5354415445ULL     // "BSMSTATE"
+
+// Result of load_estimator_state
+enum state_status
+{
+    STATE_MISSING,      // No file, a new state is started
+    STATE_LOADED,
+    STATE_INVALID       // Unreadable, truncated or not a state
+};
+
+struct estimator_state
+{
+    ui64   magic;
+    unsigned long long seed;
+    ui64   num_simulations;
+    double S0, K, T, r, q, sigma;
+    ui64   count;           // Runs
+    double sum;             // Of the run values
+    double sum_sq;
+    ui64   offset;          // First unused normal of the seed's stream
+};
+
+
+inline void init_estimator_state(estimator_state& st,
+                                 unsigned long long seed,
+                                 ui64 num_simulations, double S0, double K,
+                                 double T, double r, double q, double sigma)
+{
+    memset(&st, 0, sizeof(st));
+    st.magic           = ESTIMATOR_STATE_MAGIC;
+    st.seed            = seed;
+    st.num_simulations = num_simulations;
+    st.S0 = S0;  st.K = K;  st.T = T;
+    st.r  = r;   st.q = q;  st.sigma = sigma;
+}
+
+// Only a missing file is STATE_MISSING: a file that is there but cannot be
+//  read back whole must not be overwritten by a new state
+inline state_status load_estimator_state(const char* path,
+                                         estimator_state& st)
+{
+    FILE* f = fopen(path, "rb");
+    if (f == NULL)
+        return errno == ENOENT ? STATE_MISSING : STATE_INVALID;
+    bool ok = fread(&st, sizeof(st), 1, f) == 1
+              && fgetc(f) == EOF
+              && st.magic == ESTIMATOR_STATE_MAGIC;
+    fclose(f);
+    return ok ? STATE_LOADED : STATE_INVALID;
+}
+
+inline void save_estimator_state(const char* path, const estimator_state& st)
+{
+    std::string tmp = std::string(path) + ".tmp";
+    FILE* f = fopen(tmp.c_str(), "wb");
+    if (f == NULL || fwrite(&st, sizeof(st), 1, f) != 1)
+    {
+        fprintf(stderr, "Cannot write %s\n", tmp.c_str());
+        exit(1);
+    }
+    fclose(f);
+    if (rename(tmp.c_str(), path) != 0)
+    {
+        fprintf(stderr, "Cannot rename %s\n", tmp.c_str());
+        exit(1);
+    }
+}
+
+// Same number of paths per run and same contract
+inline bool estimator_state_matches(const estimator_state& st,
+                                    ui64 num_simulations, double S0, double K,
+                                    double T, double r, double q, double sigma)
+{
+    return st.num_simulations == num_simulations && st.S0 == S0
+           && st.K == K && st.T == T && st.r == r && st.q == q
+           && st.sigma == sigma;
+}
+
+// Adds the runs of one job
+inline void merge_estimator_state(estimator_state& st, ui64 count,
+                                  double sum, double sum_sq, ui64 used)
+{
+    st.count  += count;
+    st.sum    += sum;
+    st.sum_sq += sum_sq;
+    st.offset += used;
+}
+
+inline double estimator_mean(const estimator_state& st)
+{
+    return st.count > 0 ? st.sum / st.count : 0.0;
+}
+
+// Standard error of the mean of the runs
+inline double estimator_std_error(const estimator_state& st)
+{
+    if (st.count < 2)
+        return 0.0;
+    double mean = st.sum / st.count;
+    double var  = (st.sum_sq - st.count * mean * mean) / (st.count - 1);
+    return sqrt(std::max(var, 0.0) / st.count);
+}
+
+#endif
@@ -0,0 +1,253 @@
+// COS mode: Fang-Oosterlee Fourier-cosine pricing of European options for
+//  any model with a known characteristic function
+// With z = ln(S_T / F) truncated to [a, b] and u_k = k pi / (b - a), the
+//  price of a strike K = kappa F is
+//      V = F e^-rT sum'_k Re[phi(u_k) e^(-i u_k a)] H_k(kappa)
+//  H_k the cosine coefficient of the payoff (e^z - kappa)^+ (or
+//  (kappa - e^z)^+ for a put), closed form
+// H only depends on the strikes and [a, b], not on the model: it is built
+//  once per strike set, then pricing a whole strike vector is N evaluations
+//  of phi plus one matrix-vector product (cblas_dgemv)
+// The model is a template parameter: any type with
+//      std::complex<double> operator()(double u) const
+//  returning the characteristic function of ln(S_T / F_T) at its maturity
+
+#ifndef COS_HXX
+#define COS_HXX
+
+#include <iostream>
+#include <iomanip>
+#include <cmath>
+#include <complex>
+#include <algorithm>
+
+#include "mc_utils.hxx"
+#include "analytic.hxx"
+#include "heston.hxx"
+#include "merton.hxx"
+
+// Half width of [a, b] in standard deviations of ln(S_T / F)
+#define COS_WIDTH 10.0
+
+
+// Strike set: moneyness K / F of each strike, N x n_strikes coefficients
+struct cos_strikes
+{
+    int     num_strikes;
+    int     num_terms;
+    double  a, b;
+    double* kappa;
+    double* cp;         // 1 call, -1 put
+    double* H;          // Row major, num_strikes x num_terms
+};
+
+
+// [a, b] is centred on the GBM mean -vol^2 T / 2, vol must bound the
+//  volatility of the models priced with the set (jumps included)
+inline cos_strikes cos_make_strikes(int num_strikes, const double* kappa,
+                                    const double* cp, int num_terms,
+                                    double T, double vol)
+{
+    cos_strikes ks;
+    ks.num_strikes = num_strikes;
+    ks.num_terms   = num_terms;
+    double center  = -0.5 * vol * vol * T;
+    ks.a = center - COS_WIDTH * vol * sqrt(T);
+    ks.b = center + COS_WIDTH * vol * sqrt(T);
+    ks.kappa = (double*)malloc(num_strikes * sizeof(double));
+    ks.cp    = (double*)malloc(num_strikes * sizeof(double));
+    ks.H     = (double*)malloc((size_t)num_strikes * num_terms
+                               * sizeof(double));
+
+    double a = ks.a, b = ks.b;
+    double scale = 2.0 / (b - a);
+    for (int j = 0; j < num_strikes; ++j)
+    {
+        ks.kappa[j] = kappa[j];
+        ks.cp[j]    = cp[j];
+        // Integration range of the payoff inside [a, b]
+        double x = log(kappa[j]);
+        double c = cp[j] > 0.0 ? std::min(std::max(x, a), b) : a;
+        double d = cp[j] > 0.0 ? b : std::min(std::max(x, a), b);
+        double* H = ks.H + (size_t)j * num_terms;
+        for (int k = 0; k < num_terms; ++k)
+        {
+            double u  = k * M_PI / (b - a);
+            // chi = int_c^d e^z cos(u (z - a)), psi = int_c^d cos(u (z - a))
+            double cd = cos(u * (d - a)), sd = sin(u * (d - a));
+            double cc = cos(u * (c - a)), sc = sin(u * (c - a));
+            double chi = (exp(d) * (cd + u * sd) - exp(c) * (cc + u * sc))
+                         / (1.0 + u * u);
+            double psi = k == 0 ? d - c : (sd - sc) / u;
+            H[k] = scale * cp[j] * (chi - kappa[j] * psi);
+        }
+        // First term of the cosine series has weight 1/2
+        H[0] *= 0.5;
+    }
+    return ks;
+}
+
+inline void free_cos_strikes(cos_strikes& ks)
+{
+    free(ks.kappa);
+    free(ks.cp);
+    free(ks.H);
+}
+
+
+// Prices of the whole strike set, F the forward and df the discount factor
+//  to the maturity of the model, work must hold num_terms doubles
+template <class Model>
+inline void cos_price(const Model& model, const cos_strikes& ks, double F,
+                      double df, double* work, double* prices)
+{
+    const std::complex<double> i(0.0, 1.0);
+    for (int k = 0; k < ks.num_terms; ++k)
+    {
+        double u = k * M_PI / (ks.b - ks.a);
+        work[k]  = std::real(model(u) * std::exp(-i * u * ks.a));
+    }
+    cblas_dgemv(CblasRowMajor, CblasNoTrans, ks.num_strikes, ks.num_terms,
+                F * df, ks.H, ks.num_terms, work, 1, 0.0, prices, 1);
+}
+
+
+// Models
+
+struct gbm_cf
+{
+    double sigma, T;
+    std::complex<double> operator()(double u) const
+    {
+        const std::complex<double> i(0.0, 1.0);
+        return std::exp(-0.5 * sigma * sigma * T * (u * u + i * u));
+    }
+};
+
+struct heston_model_cf
+{
+    heston_params hp;
+    double T;
+    std::complex<double> operator()(double u) const
+    {
+        return heston_cf(std::complex<double>(u, 0.0), T, hp);
+    }
+};
+
+// Diffusion plus compensated lognormal jumps
+struct merton_cf
+{
+    double sigma, T;
+    merton_params mp;
+    std::complex<double> operator()(double u) const
+    {
+        const std::complex<double> i(0.0, 1.0);
+        double k = exp(mp.mu_J + 0.5 * mp.sigma_J * mp.sigma_J) - 1.0;
+        std::complex<double> jump = std::exp(i * u * mp.mu_J
+                                             - 0.5 * mp.sigma_J * mp.sigma_J
+                                               * u * u) - 1.0;
+        return std::exp(T * (-0.5 * sigma * sigma * (u * u + i * u)
+                             - i * u * mp.lambda * k + mp.lambda * jump));
+    }
+};
+
+
+// Prices the same strike set under one model num_runs times, prints the
+//  max error against the reference prices
+template <class Model>
+inline void cos_report(const char* name, const Model& model,
+                       const cos_strikes& ks, double F, double df,
+                       ui64 num_runs, const double* ref, double* work,
+                       double* prices)
+{
+    double t1 = dml_micros();
+    for (ui64 run = 0; run < num_runs; ++run)
+    {
+        cos_price(model, ks, F, df, work, prices);
+    }
+    double t2 = dml_micros();
+
+    double max_error = 0.0;
+    for (int j = 0; j < ks.num_strikes; ++j)
+        max_error = std::max(max_error, fabs(prices[j] - ref[j]));
+
+    double seconds = (t2 - t1) / 1000000.0;
+    std::cout << " " << name << " max error= " << std::scientific
+              << std::setprecision(3) << max_error << std::fixed
+              << std::setprecision(6) << ", " << num_runs << " strike vectors"
+              << " in " << seconds << " seconds, "
+              << 1000000.0 * seconds / num_runs << " us per vector"
+              << std::endl;
+}
+
+
+// num_simulations calls with strikes spread over [K / 2, 2 K], priced with
+//  N = 256 terms under GBM, Heston and Merton
+inline void run_cos(ui64 num_simulations, ui64 num_runs, double S0, double K,
+                    double T, double r, double q, double sigma)
+{
+    const int num_terms = 256;
+    int n = (int)num_simulations;
+    if (n < 1)
+    {
+        std::cerr << "cos needs at least one strike" << std::endl;
+        return;
+    }
+    double F  = S0 * exp((r - q) * T);
+    double df = exp(-r * T);
+
+    heston_params hp  = default_heston_params();
+    merton_params mp  = default_merton_params();
+    double merton_vol = sqrt(sigma * sigma + mp.lambda
+                             * (mp.mu_J * mp.mu_J
+                                + mp.sigma_J * mp.sigma_J));
+    double vol = std::max(std::max(sigma, merton_vol),
+                          sqrt(std::max(hp.v0, hp.theta)));
+
+    double* strikes = (double*)malloc(n * sizeof(double));
+    double* kappa   = (double*)malloc(n * sizeof(double));
+    double* cp      = (double*)malloc(n * sizeof(double));
+    for (int j = 0; j < n; ++j)
+    {
+        strikes[j] = K * pow(4.0, (j + 0.5) / n - 0.5);
+        kappa[j]   = strikes[j] / F;
+        cp[j]      = 1.0;
+    }
+
+    double t1 = dml_micros();
+    cos_strikes ks = cos_make_strikes(n, kappa, cp, num_terms, T, vol);
+    double t2 = dml_micros();
+    std::cout << std::fixed << std::setprecision(6);
+    std::cout << " " << n << " strikes, " << num_terms
+              << " terms, coefficients in " << (t2 - t1) / 1000000.0
+              << " seconds" << std::endl;
+
+    double* work   = (double*)malloc(num_terms * sizeof(double));
+    double* prices = (double*)malloc(n * sizeof(double));
+    double* ref    = (double*)malloc(n * sizeof(double));
+
+    gbm_cf gbm = {sigma, T};
+    for (int j = 0; j < n; ++j)
+        ref[j] = black_scholes_call(S0, strikes[j], T, r, q, sigma);
+    cos_report("gbm", gbm, ks, F, df, num_runs, ref, work, prices);
+
+    heston_model_cf heston = {hp, T};
+    for (int j = 0; j < n; ++j)
+        ref[j] = heston_call(S0, strikes[j], T, r, q, hp);
+    cos_report("heston", heston, ks, F, df, num_runs, ref, work, prices);
+
+    merton_cf merton = {sigma, T, mp};
+    for (int j = 0; j < n; ++j)
+        ref[j] = merton_call(S0, strikes[j], T, r, q, sigma, mp);
+    cos_report("merton", merton, ks, F, df, num_runs, ref, work, prices);
+
+    free(strikes);
+    free(kappa);
+    free(cp);
+    free(work);
+    free(prices);
+    free(ref);
+    free_cos_strikes(ks);
+}
+
+#endif
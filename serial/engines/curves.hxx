@@ -0,0 +1,158 @@
+// Term structures for r(t), q(t) and sigma(t)
+// A curve is given by knots (t_i, v_i), either piecewise flat (v_i holds
+//  on (t_i-1, t_i]) or linear between knots, flat outside of them
+// The integrals of f and f^2 from 0 to every knot are computed when the
+//  curve is built, so any integral is one lookup plus the last partial
+//  segment, and the exact GBM drift and variance between two dates are
+//      drift = int (r - q) - 1/2 int sigma^2,   vol = sqrt(int sigma^2)
+// Time-stepped engines read them from contiguous per step tables
+
+#ifndef CURVES_HXX
+#define CURVES_HXX
+
+#include <cmath>
+#include <cstdlib>
+
+enum curve_interp
+{
+    CURVE_PIECEWISE_FLAT,
+    CURVE_LINEAR
+};
+
+struct curve
+{
+    int          n;
+    curve_interp interp;
+    double*      times;         // Increasing, times[0] > 0
+    double*      values;
+    double*      integral;      // int_0^times[i] f
+    double*      integral_sq;   // int_0^times[i] f^2
+};
+
+
+// Integral of f and f^2 on [a, b] inside segment i (between knot i - 1,
+//  or 0, and knot i), i == n is the flat extrapolation after the last knot
+inline void curve_segment(const curve& c, int i, double a, double b,
+                          double* I, double* I_sq)
+{
+    double h = b - a;
+    if (c.interp == CURVE_PIECEWISE_FLAT || i == 0 || i == c.n)
+    {
+        double v = i == c.n ? c.values[c.n - 1] : c.values[i];
+        *I    = v * h;
+        *I_sq = v * v * h;
+        return;
+    }
+    // Linear between (t0, v0) and (t1, v1)
+    double t0 = c.times[i - 1], t1 = c.times[i];
+    double v0 = c.values[i - 1], v1 = c.values[i];
+    double slope = (v1 - v0) / (t1 - t0);
+    double fa = v0 + slope * (a - t0);
+    double fb = v0 + slope * (b - t0);
+    *I    = 0.5 * (fa + fb) * h;
+    *I_sq = (fa * fa + fa * fb + fb * fb) * h / 3.0;
+}
+
+inline curve make_curve(int n, const double* times, const double* values,
+                        curve_interp interp)
+{
+    curve c;
+    c.n           = n;
+    c.interp      = interp;
+    c.times       = (double*)malloc(n * sizeof(double));
+    c.values      = (double*)malloc(n * sizeof(double));
+    c.integral    = (double*)malloc(n * sizeof(double));
+    c.integral_sq = (double*)malloc(n * sizeof(double));
+    double I = 0.0, I_sq = 0.0;
+    for (int i = 0; i < n; ++i)
+    {
+        c.times[i]  = times[i];
+        c.values[i] = values[i];
+        double s, s_sq;
+        curve_segment(c, i, i > 0 ? times[i - 1] : 0.0, times[i], &s, &s_sq);
+        I    += s;
+        I_sq += s_sq;
+        c.integral[i]    = I;
+        c.integral_sq[i] = I_sq;
+    }
+    return c;
+}
+
+// Constant curve, what main uses for r, q and sigma
+inline curve flat_curve(double value)
+{
+    double t = 1.0;
+    return make_curve(1, &t, &value, CURVE_PIECEWISE_FLAT);
+}
+
+inline void free_curve(curve& c)
+{
+    free(c.times);
+    free(c.values);
+    free(c.integral);
+    free(c.integral_sq);
+}
+
+// int_0^t f and int_0^t f^2
+inline void curve_integrals(const curve& c, double t, double* I,
+                            double* I_sq)
+{
+    // Number of knots before t, curves are short so a linear scan is fine
+    int i = 0;
+    while (i < c.n && c.times[i] < t)
+        ++i;
+    double base    = i > 0 ? c.integral[i - 1] : 0.0;
+    double base_sq = i > 0 ? c.integral_sq[i - 1] : 0.0;
+    double s, s_sq;
+    curve_segment(c, i, i > 0 ? c.times[i - 1] : 0.0, t, &s, &s_sq);
+    *I    = base + s;
+    *I_sq = base_sq + s_sq;
+}
+
+inline double curve_integral(const curve& c, double t)
+{
+    double I, I_sq;
+    curve_integrals(c, t, &I, &I_sq);
+    return I;
+}
+
+inline double curve_integral_sq(const curve& c, double t)
+{
+    double I, I_sq;
+    curve_integrals(c, t, &I, &I_sq);
+    return I_sq;
+}
+
+
+// Exact drift and standard deviation of log(S(t1) / S(t0))
+inline void integrated_drift_vol(const curve& r, const curve& q,
+                                 const curve& sigma, double t0, double t1,
+                                 double* drift, double* vol)
+{
+    double var = curve_integral_sq(sigma, t1) - curve_integral_sq(sigma, t0);
+    *drift = curve_integral(r, t1) - curve_integral(r, t0)
+             - (curve_integral(q, t1) - curve_integral(q, t0))
+             - 0.5 * var;
+    *vol   = sqrt(var);
+}
+
+// Discount factor e^(-int_0^t r)
+inline double curve_discount(const curve& r, double t)
+{
+    return exp(-curve_integral(r, t));
+}
+
+// Per step tables for time-stepped engines, step j goes from times[j - 1]
+//  (0 for j = 0) to times[j]
+inline void curve_step_tables(const curve& r, const curve& q,
+                              const curve& sigma, const double* times,
+                              int num_steps, double* drift, double* vol)
+{
+    for (int j = 0; j < num_steps; ++j)
+    {
+        integrated_drift_vol(r, q, sigma, j > 0 ? times[j - 1] : 0.0,
+                             times[j], &drift[j], &vol[j]);
+    }
+}
+
+#endif
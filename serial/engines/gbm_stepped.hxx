@@ -0,0 +1,92 @@
+// Time-stepped GBM call, the flat volatility baseline the stochastic, jump
+//  and local volatility engines compare their price and speed with
+// Same tiling as the other path engines: normals of a tile drawn
+//  time-major in one RNG call, log spot of the tile in L1
+
+#ifndef GBM_STEPPED_HXX
+#define GBM_STEPPED_HXX
+
+#include <cmath>
+#include <algorithm>
+
+#include "mc_utils.hxx"
+
+#define GS_TILE 256
+
+
+// Adds the undiscounted sum of the call payoffs of num_simulations paths
+// Z_tile must hold GS_TILE * num_steps doubles, log_S GS_TILE doubles
+inline void gbm_stepped_monte_carlo(double S0, double K, int num_steps,
+                                    double drift, double vol,
+                                    ui64 num_simulations,
+                                    VSLStreamStatePtr stream, double* Z_tile,
+                                    double* log_S, double* sum)
+{
+    double sum_payoffs = 0.0;
+    for (ui64 start = 0; start < num_simulations; start += GS_TILE)
+    {
+        ui64 len = std::min((ui64)GS_TILE, num_simulations - start);
+        gaussian_armpl(len * num_steps, Z_tile, stream);
+
+        for (ui64 i = 0; i < len; ++i)
+            log_S[i] = 0.0;
+        for (int t = 0; t < num_steps; ++t)
+        {
+            const double* Z = Z_tile + t * len;
+            for (ui64 i = 0; i < len; ++i)
+                log_S[i] += drift + vol * Z[i];
+        }
+        for (ui64 i = 0; i < len; ++i)
+            sum_payoffs += std::max(S0 * exp(log_S[i]) - K, 0.0);
+    }
+    *sum += sum_payoffs;
+}
+
+
+// Prices the call with num_steps steps, the time taken goes in *seconds
+inline double run_gbm_stepped(ui64 num_simulations, ui64 num_runs,
+                              unsigned long long global_seed, double S0,
+                              double K, double T, double r, double q,
+                              double sigma, int num_steps, double* seconds)
+{
+    double dt    = T / num_steps;
+    double drift = (r - q - 0.5 * sigma * sigma) * dt;
+    double vol   = sigma * sqrt(dt);
+    double sum   = 0.0;
+    double t1    = dml_micros();
+
+    int num_threads = get_num_threads();
+    VSLStreamStatePtr parallel_streams[num_threads];
+    init_streams(parallel_streams, num_threads, global_seed,
+                 num_simulations * num_runs * num_steps);
+
+    #pragma omp parallel default(shared)
+    {
+        double* Z_tile = (double*)malloc(GS_TILE * num_steps
+                                         * sizeof(double));
+        double* log_S  = (double*)malloc(GS_TILE * sizeof(double));
+        double partial_sum = 0.0;
+        int thread_rank = get_thread_rank();
+
+        #pragma omp for schedule(runtime)
+        for (ui64 run = 0; run < num_runs; ++run)
+        {
+            gbm_stepped_monte_carlo(S0, K, num_steps, drift, vol,
+                                    num_simulations,
+                                    parallel_streams[thread_rank], Z_tile,
+                                    log_S, &partial_sum);
+        }
+
+        free(Z_tile);
+        free(log_S);
+
+        #pragma omp atomic
+        sum += partial_sum;
+    }
+    delete_streams(parallel_streams, num_threads);
+
+    *seconds = (dml_micros() - t1) / 1000000.0;
+    return exp(-r * T) * sum / ((double)num_simulations * num_runs);
+}
+
+#endif
@@ -0,0 +1,151 @@
+// Greeks mode: the call price and its Greeks from the same pass
+// Pathwise estimators for delta, vega and rho, likelihood ratio weights
+//  (Z / (S0 sigma sqrt(T))) for gamma and for the digital, everything is
+//  read from the Z_tab and ST the price needs anyway
+//
+//  delta   = e^-rT 1{ST>K} ST / S0
+//  vega    = e^-rT 1{ST>K} ST sqrt(T) (Z - sigma sqrt(T))
+//  rho     = e^-rT 1{ST>K} K T
+//  gamma   = e^-rT 1{ST>K} K Z / (S0^2 sigma sqrt(T))
+//  digital = e^-rT 1{ST>K},  digital delta = e^-rT 1{ST>K} Z / (S0 sigma sqrt(T))
+
+#ifndef GREEKS_HXX
+#define GREEKS_HXX
+
+#include <iostream>
+#include <iomanip>
+#include <cmath>
+#include <algorithm>
+
+#include "mc_utils.hxx"
+#include "analytic.hxx"
+
+// Raw per path quantities, scaled into Greeks once at the end
+// For each of them we keep the sum and the sum of squares (standard error)
+#define NUM_RAW 5
+#define RAW_PAYOFF 0    // (ST - K)+
+#define RAW_ST_ITM 1    // 1{ST>K} ST
+#define RAW_Z_ITM  2    // 1{ST>K} Z
+#define RAW_VEGA   3    // 1{ST>K} ST (Z - sigma sqrt(T))
+#define RAW_ITM    4    // 1{ST>K}
+
+
+// Adds the raw sums and sums of squares of num_simulations paths
+inline void black_scholes_monte_carlo_greeks(double S0, double K,
+                                             ui64 num_simulations, double drift,
+                                             double vol,
+                                             VSLStreamStatePtr stream,
+                                             double* Z_tab, double* sums,
+                                             double* sums_sq)
+{
+    gaussian_armpl(num_simulations, Z_tab, stream);
+
+    double s_payoff = 0.0, s_st = 0.0, s_z = 0.0, s_vega = 0.0, s_itm = 0.0;
+    double q_payoff = 0.0, q_st = 0.0, q_z = 0.0, q_vega = 0.0;
+
+    for (ui64 i = 0; i < num_simulations; ++i)
+    {
+        double Z   = Z_tab[i];
+        double ST  = S0 * exp(drift + vol * Z);
+        double itm = ST > K ? 1.0 : 0.0;
+        double payoff = itm * (ST - K);
+        double st  = itm * ST;
+        double z   = itm * Z;
+        double v   = st * (Z - vol);
+        s_payoff += payoff;  q_payoff += payoff * payoff;
+        s_st     += st;      q_st     += st * st;
+        s_z      += z;       q_z      += z * z;
+        s_vega   += v;       q_vega   += v * v;
+        // itm * itm == itm
+        s_itm    += itm;
+    }
+
+    sums[RAW_PAYOFF] += s_payoff;  sums_sq[RAW_PAYOFF] += q_payoff;
+    sums[RAW_ST_ITM] += s_st;      sums_sq[RAW_ST_ITM] += q_st;
+    sums[RAW_Z_ITM]  += s_z;       sums_sq[RAW_Z_ITM]  += q_z;
+    sums[RAW_VEGA]   += s_vega;    sums_sq[RAW_VEGA]   += q_vega;
+    sums[RAW_ITM]    += s_itm;     sums_sq[RAW_ITM]    += s_itm;
+}
+
+
+inline void run_greeks(ui64 num_simulations, ui64 num_runs,
+                       unsigned long long global_seed, double S0, double K,
+                       double T, double r, double q, double sigma)
+{
+    double drift = (r - q - 0.5 * sigma * sigma) * T;
+    double vol   = sigma * sqrt(T);
+
+    double sums[NUM_RAW]    = {0.0};
+    double sums_sq[NUM_RAW] = {0.0};
+    double t1 = dml_micros();
+
+    int num_threads = get_num_threads();
+    VSLStreamStatePtr parallel_streams[num_threads];
+    init_streams(parallel_streams, num_threads, global_seed,
+                 num_simulations * num_runs);
+
+    #pragma omp parallel default(shared)
+    {
+        double* Z_tab = (double*)malloc(num_simulations * sizeof(double));
+        double partial_sums[NUM_RAW]    = {0.0};
+        double partial_sums_sq[NUM_RAW] = {0.0};
+        int thread_rank = get_thread_rank();
+
+        #pragma omp for schedule(runtime)
+        for (ui64 run = 0; run < num_runs; ++run)
+        {
+            black_scholes_monte_carlo_greeks(S0, K, num_simulations,
+                                             drift, vol,
+                                             parallel_streams[thread_rank],
+                                             Z_tab, partial_sums,
+                                             partial_sums_sq);
+        }
+
+        free(Z_tab);
+
+        for (int k = 0; k < NUM_RAW; ++k)
+        {
+            #pragma omp atomic
+            sums[k] += partial_sums[k];
+            #pragma omp atomic
+            sums_sq[k] += partial_sums_sq[k];
+        }
+    }
+    delete_streams(parallel_streams, num_threads);
+
+    double t2 = dml_micros();
+
+    // Greek = scale * mean of its raw quantity
+    double disc = exp(-r * T);
+    double N    = (double)num_simulations * num_runs;
+    const int num_greeks = 7;
+    const char* names[num_greeks] = {"price", "delta", "gamma", "vega",
+                                     "rho", "digital", "digital_delta"};
+    const int raw[num_greeks] = {RAW_PAYOFF, RAW_ST_ITM, RAW_Z_ITM, RAW_VEGA,
+                                 RAW_ITM, RAW_ITM, RAW_Z_ITM};
+    const double scale[num_greeks] = {disc, disc / S0,
+                                      disc * K / (S0 * S0 * vol),
+                                      disc * sqrt(T), disc * K * T, disc,
+                                      disc / (S0 * vol)};
+    const double refs[num_greeks] = {
+        black_scholes_call(S0, K, T, r, q, sigma),
+        call_delta(S0, K, T, r, q, sigma),
+        call_gamma(S0, K, T, r, q, sigma),
+        call_vega(S0, K, T, r, q, sigma),
+        call_rho(S0, K, T, r, q, sigma),
+        cash_or_nothing_call(S0, K, 1.0, T, r, q, sigma),
+        digital_delta(S0, K, T, r, q, sigma)};
+
+    std::cout << std::fixed << std::setprecision(6);
+    for (int g = 0; g < num_greeks; ++g)
+    {
+        double mean = sums[raw[g]] / N;
+        double var  = std::max(sums_sq[raw[g]] / N - mean * mean, 0.0);
+        std::cout << " " << names[g] << " value= " << scale[g] * mean
+                  << " stderr= " << scale[g] * sqrt(var / N)
+                  << " ref= " << refs[g] << std::endl;
+    }
+    std::cout << " in " << (t2-t1)/1000000.0 << " seconds" << std::endl;
+}
+
+#endif
@@ -0,0 +1,209 @@
+// Growth index mode: strike and spot ladders from one simulation
+// Under GBM S_T = S0 g_i with g_i = exp(drift + vol Z_i), g does not depend
+//  on S0 or K, so with the g_i sorted
+//      sum_i (S0 g_i - K)^+ = S0 (sum of the g_i > K / S0) - K (their count)
+//  a call (or put) at any (S0, K) of the same maturity and volatility is
+//  one binary search plus a lookup in the suffix sums: same estimator as
+//  black_scholes_monte_carlo on these paths, no new normal and no exp
+// Compact form: the sorted g_i plus suffix sums at every GI_BLOCK-th index
+//  (8.5 bytes per path), a query adds the < GI_BLOCK values up to the next
+//  block boundary
+// Building: every thread simulates and sorts its contiguous chunk, the
+//  chunks are merged pairwise in parallel, suffix sums use Kahan
+//  summation (1e8 terms would lose ~8 digits otherwise)
+
+#ifndef GROWTH_INDEX_HXX
+#define GROWTH_INDEX_HXX
+
+#include <iostream>
+#include <iomanip>
+#include <cmath>
+#include <algorithm>
+
+#include "mc_utils.hxx"
+#include "analytic.hxx"
+
+#define GI_BLOCK 16
+#define GI_TILE 4096
+
+struct growth_index
+{
+    ui64    n;
+    double  drift, vol;     // Of ln(S_T / S0), the index is only valid there
+    double* g;              // Increasing
+    double* block_sum;      // block_sum[b] = sum of g[b * GI_BLOCK ...]
+    double  total;
+};
+
+inline void free_growth_index(growth_index& gi)
+{
+    free(gi.g);
+    free(gi.block_sum);
+}
+
+
+// Simulates n growth factors and builds the index
+inline growth_index build_growth_index(ui64 n, double drift, double vol,
+                                       unsigned long long global_seed)
+{
+    growth_index gi;
+    gi.n     = n;
+    gi.drift = drift;
+    gi.vol   = vol;
+    gi.g     = (double*)malloc(n * sizeof(double));
+    ui64 num_blocks = n / GI_BLOCK + 1;
+    gi.block_sum = (double*)malloc((num_blocks + 1) * sizeof(double));
+
+    int num_threads = get_num_threads();
+    ui64 chunk = (n + num_threads - 1) / num_threads;
+    VSLStreamStatePtr parallel_streams[num_threads];
+    init_streams(parallel_streams, num_threads, global_seed, chunk);
+
+    #pragma omp parallel default(shared)
+    {
+        int rank   = get_thread_rank();
+        ui64 first = std::min(rank * chunk, n);
+        ui64 len   = std::min(chunk, n - first);
+        double* g  = gi.g + first;
+        for (ui64 start = 0; start < len; start += GI_TILE)
+        {
+            ui64 tile = std::min((ui64)GI_TILE, len - start);
+            gaussian_armpl(tile, g + start, parallel_streams[rank]);
+            for (ui64 i = start; i < start + tile; ++i)
+                g[i] = exp(drift + vol * g[i]);
+        }
+        std::sort(g, g + len);
+    }
+    delete_streams(parallel_streams, num_threads);
+
+    // Pairwise merges of the sorted chunks
+    for (ui64 width = chunk; width < n; width *= 2)
+    {
+        ui64 num_pairs = (n + 2 * width - 1) / (2 * width);
+        #pragma omp parallel for schedule(dynamic)
+        for (ui64 p = 0; p < num_pairs; ++p)
+        {
+            ui64 lo  = p * 2 * width;
+            ui64 mid = std::min(lo + width, n);
+            ui64 hi  = std::min(lo + 2 * width, n);
+            std::inplace_merge(gi.g + lo, gi.g + mid, gi.g + hi);
+        }
+    }
+
+    // Suffix sums at the block boundaries, from the top
+    double sum = 0.0, c = 0.0;
+    gi.block_sum[num_blocks] = 0.0;
+    for (ui64 b = num_blocks; b-- > 0;)
+    {
+        ui64 lo = b * GI_BLOCK;
+        ui64 hi = std::min(lo + GI_BLOCK, n);
+        double block = 0.0;
+        for (ui64 i = lo; i < hi; ++i)
+            block += gi.g[i];
+        double y = block - c;
+        double t = sum + y;
+        c   = (t - sum) - y;
+        sum = t;
+        gi.block_sum[b] = sum;
+    }
+    gi.total = sum;
+    return gi;
+}
+
+
+// Sum of the g_i with index >= k
+inline double growth_suffix_sum(const growth_index& gi, ui64 k)
+{
+    ui64 b   = (k + GI_BLOCK - 1) / GI_BLOCK;
+    ui64 end = std::min(b * GI_BLOCK, gi.n);
+    double sum = b * GI_BLOCK < gi.n ? gi.block_sum[b] : 0.0;
+    for (ui64 i = k; i < end; ++i)
+        sum += gi.g[i];
+    return sum;
+}
+
+// Undiscounted mean payoff of the call (cp = 1) or put (cp = -1)
+inline double growth_index_payoff(const growth_index& gi, double S0,
+                                  double K, double cp)
+{
+    // First g_i with S0 g_i > K
+    ui64 k = std::upper_bound(gi.g, gi.g + gi.n, K / S0) - gi.g;
+    double above = growth_suffix_sum(gi, k);
+    double count = (double)(gi.n - k);
+    double call  = S0 * above - K * count;
+    double put   = K * (gi.n - count) - S0 * (gi.total - above);
+    return (cp > 0.0 ? call : put) / gi.n;
+}
+
+
+// Index of num_simulations paths, then num_runs ladders of 1000 (S0, K)
+//  points, checked against the direct sum over the same paths and BSM
+inline void run_growth_index(ui64 num_simulations, ui64 num_runs,
+                             unsigned long long global_seed, double S0,
+                             double K, double T, double r, double q,
+                             double sigma)
+{
+    const int num_points = 1000;
+    double drift = (r - q - 0.5 * sigma * sigma) * T;
+    double vol   = sigma * sqrt(T);
+    double df    = exp(-r * T);
+
+    double t1 = dml_micros();
+    growth_index gi = build_growth_index(num_simulations, drift, vol,
+                                         global_seed);
+    double t2 = dml_micros();
+
+    // Ladder: strikes from K / 2 to 2 K, spots from 0.8 S0 to 1.2 S0
+    double spots[num_points], strikes[num_points], prices[num_points];
+    for (int p = 0; p < num_points; ++p)
+    {
+        spots[p]   = S0 * (0.8 + 0.4 * (p % 10) / 9.0);
+        strikes[p] = K * pow(4.0, (p / 10 + 0.5) / (num_points / 10) - 0.5);
+    }
+    double t3 = dml_micros();
+    for (ui64 run = 0; run < num_runs; ++run)
+    {
+        for (int p = 0; p < num_points; ++p)
+            prices[p] = df * growth_index_payoff(gi, spots[p], strikes[p],
+                                                 1.0);
+    }
+    double t4 = dml_micros();
+
+    // Direct sums over the same paths for a few points
+    const int num_direct = 5;
+    double max_direct = 0.0, max_bs = 0.0;
+    double t5 = dml_micros();
+    for (int p = 0; p < num_direct; ++p)
+    {
+        int point = p * (num_points / num_direct) + 3;
+        double sum = 0.0;
+        #pragma omp parallel for reduction(+:sum)
+        for (ui64 i = 0; i < gi.n; ++i)
+            sum += std::max(spots[point] * gi.g[i] - strikes[point], 0.0);
+        max_direct = std::max(max_direct,
+                              fabs(prices[point] - df * sum / gi.n));
+    }
+    double t6 = dml_micros();
+    for (int p = 0; p < num_points; ++p)
+        max_bs = std::max(max_bs, fabs(prices[p]
+                          - black_scholes_call(spots[p], strikes[p], T, r, q,
+                                               sigma)));
+
+    double seconds_point = (t4 - t3) / 1000000.0 / (num_runs * num_points);
+    std::cout << std::fixed << std::setprecision(6);
+    std::cout << " index of " << gi.n << " paths in " << (t2 - t1) / 1000000.0
+              << " seconds (" << (gi.n * sizeof(double)
+                                  + (gi.n / GI_BLOCK + 2) * sizeof(double))
+                                 / 1e6 << " MB)" << std::endl;
+    std::cout << " max error vs direct sum= " << std::scientific
+              << std::setprecision(3) << max_direct << " vs bsm= " << max_bs
+              << std::fixed << std::setprecision(6) << std::endl;
+    std::cout << " " << num_runs * num_points << " ladder points, "
+              << 1e6 * seconds_point << " us per point, direct sum "
+              << (t6 - t5) / num_direct / 1000000.0 << " seconds per point"
+              << std::endl;
+
+    free_growth_index(gi);
+}
+
+#endif
@@ -0,0 +1,150 @@
+// Implied volatility mode: batch inversion of BSM prices
+// Each quote is first turned into the out-of-the-money option of the same
+//  strike (put-call parity), its price has no intrinsic part and its log
+//  is close to linear in sigma, even far in the wings
+// Initial guess: Corrado-Miller closed form, then a fixed number of
+//  Halley (Householder order 2) steps on ln(price(sigma)) - ln(quote),
+//  using the analytic vega and volga
+// No branch in the loop: quotes are clamped into the no-arbitrage bounds,
+//  sigma is clamped into [IV_MIN, IV_MAX] after every step, so the loop is
+//  the same for every lane and vectorizes
+
+#ifndef IMPLIED_VOL_HXX
+#define IMPLIED_VOL_HXX
+
+#include <iostream>
+#include <iomanip>
+#include <cmath>
+#include <algorithm>
+
+#include "mc_utils.hxx"
+#include "analytic_batch.hxx"
+
+#define IV_MIN 1e-3
+#define IV_MAX 5.0
+#define IV_ITERATIONS 4
+
+
+// Implied volatility of each quote, the S, K, T, r, q and cp of the batch
+//  describe the contracts (sigma is not read)
+inline void implied_vol_batch(const contract_batch& c, const double* quotes,
+                              double* implied)
+{
+    const ui64 n = c.n;
+    #pragma omp parallel for simd schedule(static)
+    for (ui64 i = 0; i < n; ++i)
+    {
+        double S = c.S[i], K = c.K[i], T = c.T[i];
+        double r = c.r[i], q = c.q[i], cp = c.cp[i];
+
+        double fwd  = S * exp(-q * T);      // Discounted forward
+        double df   = K * exp(-r * T);      // Discounted strike
+        // OTM side: call when the strike is above the forward
+        double otm  = df > fwd ? 1.0 : -1.0;
+        // Parity: C - P = fwd - df
+        double price = quotes[i] + (otm - cp) * 0.5 * (fwd - df);
+        // Stay inside (0, upper bound) of the OTM option
+        double upper = otm > 0.0 ? fwd : df;
+        price = std::min(std::max(price, 1e-300), upper * (1.0 - 1e-15));
+        double log_price = log(price);
+
+        // Corrado-Miller, with the call price of the same strike
+        double call = price + (otm < 0.0 ? fwd - df : 0.0);
+        double half = call - 0.5 * (fwd - df);
+        double disc = std::max(half * half - (fwd - df) * (fwd - df) / M_PI,
+                               0.0);
+        double sqrt_T = sqrt(T);
+        double sigma  = 2.5066282746310002 / (fwd + df)
+                        * (half + sqrt(disc)) / sqrt_T;
+        sigma = std::min(std::max(sigma, IV_MIN), IV_MAX);
+
+        double log_m = log(fwd / df);
+        for (int it = 0; it < IV_ITERATIONS; ++it)
+        {
+            double vol  = sigma * sqrt_T;
+            double d1   = log_m / vol + 0.5 * vol;
+            double d2   = d1 - vol;
+            double N1   = 0.5 * erfc(-otm * d1 * M_SQRT1_2);
+            double N2   = 0.5 * erfc(-otm * d2 * M_SQRT1_2);
+            double model = std::max(otm * (fwd * N1 - df * N2), 1e-300);
+            double vega  = fwd * 0.3989422804014327 * exp(-0.5 * d1 * d1)
+                           * sqrt_T;
+            double volga = vega * d1 * d2 / sigma;
+
+            // g = ln(model) - ln(price), Halley step on g
+            double g   = log(model) - log_price;
+            double g1  = vega / model;
+            double g2  = volga / model - g1 * g1;
+            double newton = g / std::max(g1, 1e-300);
+            double step   = newton / (1.0 - 0.5 * newton * g2
+                                      / std::max(g1, 1e-300));
+            // Halley can overshoot where g2 is large, fall back to Newton
+            step  = fabs(step) < 2.0 * fabs(newton) ? step : newton;
+            sigma = std::min(std::max(sigma - step, IV_MIN), IV_MAX);
+        }
+        implied[i] = sigma;
+    }
+}
+
+
+// Synthetic chain of num_simulations quotes, inverted num_runs times
+// The vol error is reported on all quotes and on the ones whose vega is not
+//  negligible (the vol of a quote worth 1e-12 is not defined anyway), the
+//  price error repricing every quote with its implied vol
+inline void run_implied_vol(ui64 num_simulations, ui64 num_runs,
+                            unsigned long long global_seed)
+{
+    contract_batch c = alloc_contracts(num_simulations);
+    greeks_batch g   = alloc_greeks(num_simulations);
+    double* implied  = (double*)malloc(num_simulations * sizeof(double));
+    random_contracts(c, global_seed);
+    black_scholes_batch(c, g);
+
+    double t1 = dml_micros();
+    for (ui64 run = 0; run < num_runs; ++run)
+    {
+        implied_vol_batch(c, g.price, implied);
+    }
+    double t2 = dml_micros();
+
+    double max_error = 0.0, max_error_vega = 0.0;
+    ui64 num_vega = 0;
+    for (ui64 i = 0; i < c.n; ++i)
+    {
+        double error = fabs(implied[i] - c.sigma[i]);
+        max_error = std::max(max_error, error);
+        if (g.vega[i] > 1e-3 * c.S[i])
+        {
+            max_error_vega = std::max(max_error_vega, error);
+            ++num_vega;
+        }
+    }
+
+    // Reprice with the implied vols
+    double* quotes = g.price;
+    g.price = (double*)malloc(num_simulations * sizeof(double));
+    std::swap(c.sigma, implied);
+    black_scholes_batch(c, g);
+    double max_price_error = 0.0;
+    for (ui64 i = 0; i < c.n; ++i)
+        max_price_error = std::max(max_price_error,
+                                   fabs(g.price[i] - quotes[i]));
+    free(quotes);
+
+    double seconds = (t2 - t1) / 1000000.0;
+    std::cout << std::scientific << std::setprecision(3);
+    std::cout << " max vol error= " << max_error
+              << " max vol error (vega > 1e-3 S)= " << max_error_vega
+              << " on " << num_vega << " quotes, max price error= "
+              << max_price_error << std::endl;
+    std::cout << std::fixed << std::setprecision(6);
+    std::cout << " " << c.n * num_runs << " quotes in " << seconds
+              << " seconds, " << c.n * num_runs / seconds << " quotes/s"
+              << std::endl;
+
+    free(implied);
+    free_contracts(c);
+    free_greeks(g);
+}
+
+#endif
@@ -0,0 +1,199 @@
+// Lattice mode: CRR binomial and trinomial trees for European, Bermudan and
+//  American options, for validation and small books
+// One rolling array of values per contract, updated in place: node j at
+//  step i only reads nodes j, j + 1 (j + 2) of step i + 1, which the
+//  ascending loop has not overwritten yet, so the backward step is a
+//  stencil the compiler vectorizes over the nodes
+// Spot j of a step is spot j of the next step times u (CRR) or spot j + 1
+//  (trinomial), they are kept in a second rolling array, no pow per node
+// Early exercise is max(continuation, w * payoff) with w = 1 on exercise
+//  steps and 0 otherwise (the continuation is never negative), there is
+//  no branch in the stencil
+// Far out of the money values decay into denormals on long trees, the
+//  Makefile flags (-funsafe-math-optimizations) flush them to zero, without
+//  them the CRR stencil is several times slower
+// Independent contracts are spread across the threads
+
+#ifndef LATTICE_HXX
+#define LATTICE_HXX
+
+#include <iostream>
+#include <iomanip>
+#include <cmath>
+#include <algorithm>
+
+#include "mc_utils.hxx"
+#include "analytic.hxx"
+#include "analytic_batch.hxx"
+
+enum lattice_type
+{
+    LATTICE_CRR,
+    LATTICE_TRINOMIAL
+};
+
+// Exercise steps, every k-th step for a Bermudan
+#define LATTICE_EUROPEAN 0
+#define LATTICE_AMERICAN 1
+
+// Doubles of work per contract: values and spots
+#define LATTICE_WORK_SIZE(num_steps) (2 * (2 * (num_steps) + 1))
+
+
+// Price of one contract, cp = 1 for calls and -1 for puts, exercise_every
+//  = 0 European, 1 American, k > 1 Bermudan (every k-th step)
+inline double lattice_price(double S0, double K, double T, double r, double q,
+                            double sigma, double cp, int num_steps,
+                            int exercise_every, lattice_type type, double* work)
+{
+    double dt   = T / num_steps;
+    double disc = exp(-r * dt);
+    int width   = type == LATTICE_CRR ? 1 : 2;   // Nodes added per step
+    double* V   = work;
+    double* S   = work + width * num_steps + 1;
+
+    // Up move and discounted probabilities (down, middle, up)
+    double up, p_d, p_m, p_u;
+    if (type == LATTICE_CRR)
+    {
+        up  = exp(sigma * sqrt(dt));
+        double p = (exp((r - q) * dt) - 1.0 / up) / (up - 1.0 / up);
+        p_d = disc * (1.0 - p);
+        p_m = 0.0;
+        p_u = disc * p;
+    }
+    else
+    {
+        // Hull-White, dx = sigma sqrt(3 dt)
+        double dx = sigma * sqrt(3.0 * dt);
+        double nu = r - q - 0.5 * sigma * sigma;
+        up  = exp(dx);
+        p_u = disc * (1.0 / 6.0 + nu * sqrt(dt / (12.0 * sigma * sigma)));
+        p_d = disc * (1.0 / 6.0 - nu * sqrt(dt / (12.0 * sigma * sigma)));
+        p_m = disc * 2.0 / 3.0;
+    }
+
+    // Maturity: node j has spot S0 up^(2 j - num_steps) (CRR) or
+    //  S0 up^(j - num_steps) (trinomial)
+    int num_nodes = width * num_steps + 1;
+    double ratio  = type == LATTICE_CRR ? up * up : up;
+    S[0] = S0 * pow(up, -(double)num_steps);
+    for (int j = 1; j < num_nodes; ++j)
+        S[j] = S[j - 1] * ratio;
+    for (int j = 0; j < num_nodes; ++j)
+        V[j] = std::max(cp * (S[j] - K), 0.0);
+
+    for (int i = num_steps - 1; i >= 0; --i)
+    {
+        double w = exercise_every > 0 && i % exercise_every == 0 ? 1.0 : 0.0;
+        int n = width * i + 1;
+        if (type == LATTICE_CRR)
+        {
+            #pragma omp simd
+            for (int j = 0; j < n; ++j)
+            {
+                S[j] *= up;     // Between nodes j and j + 1 of step i + 1
+                double cont = p_d * V[j] + p_u * V[j + 1];
+                V[j] = std::max(cont, w * cp * (S[j] - K));
+            }
+        }
+        else
+        {
+            #pragma omp simd
+            for (int j = 0; j < n; ++j)
+            {
+                S[j] = S[j + 1];    // Same level as node j + 1 of i + 1
+                double cont = p_d * V[j] + p_m * V[j + 1] + p_u * V[j + 2];
+                V[j] = std::max(cont, w * cp * (S[j] - K));
+            }
+        }
+    }
+    // Exercising today
+    return exercise_every > 0 ? std::max(V[0], cp * (S0 - K)) : V[0];
+}
+
+
+// Prices every contract of the batch, one contract per iteration
+inline void lattice_contracts(const contract_batch& c, int num_steps,
+                              int exercise_every, lattice_type type,
+                              double* price)
+{
+    #pragma omp parallel default(shared)
+    {
+        double* work = (double*)malloc(LATTICE_WORK_SIZE(num_steps)
+                                       * sizeof(double));
+        #pragma omp for schedule(dynamic)
+        for (ui64 i = 0; i < c.n; ++i)
+        {
+            price[i] = lattice_price(c.S[i], c.K[i], c.T[i], c.r[i], c.q[i],
+                                     c.sigma[i], c.cp[i], num_steps,
+                                     exercise_every, type, work);
+        }
+        free(work);
+    }
+}
+
+
+// num_simulations random contracts, European and American, CRR and
+//  trinomial, num_steps steps
+inline void run_lattice(ui64 num_simulations, ui64 num_runs,
+                        unsigned long long global_seed, int num_steps)
+{
+    contract_batch c = alloc_contracts(num_simulations);
+    random_contracts(c, global_seed);
+    double* euro      = (double*)malloc(num_simulations * sizeof(double));
+    double* amer_crr  = (double*)malloc(num_simulations * sizeof(double));
+    double* amer_tri  = (double*)malloc(num_simulations * sizeof(double));
+
+    double t1 = dml_micros();
+    for (ui64 run = 0; run < num_runs; ++run)
+    {
+        lattice_contracts(c, num_steps, LATTICE_EUROPEAN, LATTICE_CRR, euro);
+        lattice_contracts(c, num_steps, LATTICE_AMERICAN, LATTICE_CRR,
+                          amer_crr);
+    }
+    double t2 = dml_micros();
+    for (ui64 run = 0; run < num_runs; ++run)
+    {
+        lattice_contracts(c, num_steps, LATTICE_AMERICAN, LATTICE_TRINOMIAL,
+                          amer_tri);
+    }
+    double t3 = dml_micros();
+
+    double max_euro_error = 0.0, max_diff = 0.0, max_premium = 0.0;
+    for (ui64 i = 0; i < c.n; ++i)
+    {
+        double ref = c.cp[i] > 0.0
+            ? black_scholes_call(c.S[i], c.K[i], c.T[i], c.r[i], c.q[i],
+                                 c.sigma[i])
+            : black_scholes_put(c.S[i], c.K[i], c.T[i], c.r[i], c.q[i],
+                                c.sigma[i]);
+        max_euro_error = std::max(max_euro_error, fabs(euro[i] - ref));
+        max_diff       = std::max(max_diff, fabs(amer_crr[i] - amer_tri[i]));
+        max_premium    = std::max(max_premium, amer_crr[i] - euro[i]);
+    }
+
+    // Binomial: (n + 1)(n + 2) / 2 nodes, trinomial (n + 1)^2
+    double nodes_crr = 0.5 * (num_steps + 1.0) * (num_steps + 2.0);
+    double nodes_tri = (num_steps + 1.0) * (num_steps + 1.0);
+    double seconds_crr = (t2 - t1) / 1000000.0;
+    double seconds_tri = (t3 - t2) / 1000000.0;
+    std::cout << std::fixed << std::setprecision(6);
+    std::cout << " european max error= " << max_euro_error
+              << " american crr - trinomial max= " << max_diff
+              << " max early exercise premium= " << max_premium << std::endl;
+    std::cout << " " << num_steps << " steps, crr " << 2 * c.n * num_runs
+              << " contracts in " << seconds_crr << " seconds ("
+              << 2 * c.n * num_runs * nodes_crr / seconds_crr / 1e9
+              << " Gnodes/s), trinomial " << c.n * num_runs
+              << " contracts in " << seconds_tri << " seconds ("
+              << c.n * num_runs * nodes_tri / seconds_tri / 1e9
+              << " Gnodes/s)" << std::endl;
+
+    free(euro);
+    free(amer_crr);
+    free(amer_tri);
+    free_contracts(c);
+}
+
+#endif
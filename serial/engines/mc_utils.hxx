@@ -0,0 +1,117 @@
+// Helpers shared by BSM.cxx and the pricing engines
+// (timer, ArmPL RNG wrappers, per thread streams)
+
+#ifndef MC_UTILS_HXX
+#define MC_UTILS_HXX
+
+#include <cstdio>
+#include <cstdlib>
+#include <sys/types.h>
+#include <sys/time.h>
+
+#include <armpl.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#define ui64 u_int64_t
+
+inline double
+dml_micros()
+{
+        static struct timezone tz;
+        static struct timeval  tv;
+        gettimeofday(&tv,&tz);
+        return((tv.tv_sec*1000000.0)+tv.tv_usec);
+}
+
+
+// Helper function from ArmPL doc example
+// https://developer.arm.com/documentation/101004/2410/Open-Random-Number-Generation--OpenRNG--Reference-Guide/Examples/skipahead-c?lang=en#skipahead-c
+inline void assert_ok(int err, const char *message)
+{
+  if (err != VSL_ERROR_OK)
+  {
+    fprintf(stderr, "Error: %s\n", message);
+    exit(EXIT_FAILURE);
+  }
+}
+
+
+// Function to generate Gaussian noise using ArmPL
+inline void gaussian_armpl(const int taille, double* noise,
+                           VSLStreamStatePtr stream)
+{
+    // assert_ok(vdRngGaussian(VSL_RNG_METHOD_GAUSSIAN_BOXMULLER2,
+    //                         stream, taille, noise, 0, 1),
+    //           "Number generation failed!");
+    vdRngGaussian(VSL_RNG_METHOD_GAUSSIAN_BOXMULLER2,
+                  stream, taille, noise, 0, 1);
+}
+
+
+// Uniforms on [0, 1) using ArmPL
+inline void uniform_armpl(const int taille, double* noise,
+                          VSLStreamStatePtr stream)
+{
+    vdRngUniform(VSL_RNG_METHOD_UNIFORM_STD, stream, taille, noise, 0, 1);
+}
+
+
+// Trying to respect code compiling without -fopenmp
+inline int get_num_threads()
+{
+    int num_threads = 1;
+    #ifdef _OPENMP
+    #pragma omp parallel default(shared)
+    {
+        #pragma omp single
+        {
+            num_threads = omp_get_num_threads();
+        }
+    }
+    #endif
+    return num_threads;
+}
+
+inline int get_thread_rank()
+{
+    #ifdef _OPENMP
+    return omp_get_thread_num();
+    #else
+    return 0;
+    #endif
+}
+
+
+// Creates one stream per thread, stream i is a copy of stream i - 1
+//  skipped ahead by skip numbers so the threads never share numbers,
+//  stream 0 starts offset numbers into the seed's stream
+// VSL_BRNG_MCG59 seems faster than VSL_BRNG_MT19937.
+// DO NOT USE VSL_BRNG_NONDETERM AS IT IS SUPER SLOW AND DISREGARDS SEED!!!
+inline void init_streams(VSLStreamStatePtr* streams, int num_threads,
+                         unsigned long long seed, ui64 skip,
+                         ui64 offset = 0)
+{
+    assert_ok(vslNewStream(&streams[0], VSL_BRNG_MCG59, seed),
+              "vslNewStreamFailed");
+    if (offset > 0)
+        assert_ok(vslSkipAheadStream(streams[0], offset), "vslSkipAhead");
+    // Doing this part in parallel breaks things :/
+    for (int i = 1; i < num_threads; ++i)
+    {
+        assert_ok(vslCopyStream(&streams[i], streams[i - 1]),
+                  "vslCopyStream");
+        assert_ok(vslSkipAheadStream(streams[i], skip), "vslSkipAhead");
+    }
+}
+
+inline void delete_streams(VSLStreamStatePtr* streams, int num_threads)
+{
+    for (int i = 0; i < num_threads; ++i)
+    {
+        assert_ok(vslDeleteStream(&streams[i]), "vslDeleteStream");
+    }
+}
+
+#endif
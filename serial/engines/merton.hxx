@@ -0,0 +1,170 @@
+// Merton mode: jump-diffusion, lognormal jumps arriving with intensity
+//  lambda
+//      ln ST = ln S0 + (r - q - lambda k - sigma^2 / 2) T + sigma sqrt(T) Z1
+//              + sum_{j <= N} Y_j,   N ~ Poisson(lambda T),
+//      Y_j ~ N(mu_J, sigma_J^2),     k = E[e^Y] - 1
+// Vector friendly sampling: N by inversion of a small cumulative table
+//  (a sum of compares, no branch), and the sum of the N normal log-jumps
+//  is N(N mu_J, N sigma_J^2) so there is no loop over jumps
+// Given N the diffusion and the jumps add up to one normal of variance
+//  sigma^2 T + N sigma_J^2, so a path costs one normal and one uniform
+// Validated against the Merton series (weighted BSM prices)
+
+#ifndef MERTON_HXX
+#define MERTON_HXX
+
+#include <iostream>
+#include <iomanip>
+#include <cmath>
+#include <algorithm>
+
+#include "mc_utils.hxx"
+#include "analytic.hxx"
+#include "gbm_stepped.hxx"
+
+// Size of the Poisson table, P(N >= 16) is ~1e-17 for lambda T = 0.75
+#define MJ_MAX_JUMPS 16
+
+#define MJ_TILE 1024
+
+struct merton_params
+{
+    double lambda;  // Jump intensity (per year)
+    double mu_J;    // Mean of the log-jump
+    double sigma_J; // Standard deviation of the log-jump
+};
+
+// Parameters of the merton mode (and of the Merton reference of cos)
+inline merton_params default_merton_params()
+{
+    merton_params mp;
+    mp.lambda  = 0.75;
+    mp.mu_J    = -0.1;
+    mp.sigma_J = 0.15;
+    return mp;
+}
+
+
+// Merton series, the Poisson weighted sum of BSM prices
+//  (intensity lambda (1 + k), rate r - lambda k + n ln(1 + k) / T and
+//  volatility sqrt(sigma^2 + n sigma_J^2 / T) for n jumps)
+inline double merton_call(double S0, double K, double T, double r, double q,
+                          double sigma, const merton_params& mp)
+{
+    double k      = exp(mp.mu_J + 0.5 * mp.sigma_J * mp.sigma_J) - 1.0;
+    double lambda = mp.lambda * (1.0 + k);
+    double weight = exp(-lambda * T);       // n = 0
+    double price  = 0.0;
+    for (int n = 0; n < 100; ++n)
+    {
+        double sigma_n = sqrt(sigma * sigma
+                              + n * mp.sigma_J * mp.sigma_J / T);
+        double r_n     = r - mp.lambda * k + n * log(1.0 + k) / T;
+        price  += weight * black_scholes_call(S0, K, T, r_n, q, sigma_n);
+        weight *= lambda * T / (n + 1);
+    }
+    return price;
+}
+
+
+// Adds the undiscounted sum of the call payoffs of num_simulations paths
+// cdf[n] = P(N <= n), Z and U must hold MJ_TILE doubles
+inline void merton_monte_carlo(double S0, double K, double drift, double vol,
+                               const merton_params& mp, const double* cdf,
+                               ui64 num_simulations, VSLStreamStatePtr stream,
+                               double* Z, double* U, double* sum)
+{
+    double var   = vol * vol;
+    double var_J = mp.sigma_J * mp.sigma_J;
+    double sum_payoffs = 0.0;
+    for (ui64 start = 0; start < num_simulations; start += MJ_TILE)
+    {
+        ui64 len = std::min((ui64)MJ_TILE, num_simulations - start);
+        gaussian_armpl(len, Z, stream);
+        uniform_armpl(len, U, stream);
+
+        for (ui64 i = 0; i < len; ++i)
+        {
+            // Inversion: N = number of cdf values below U
+            double n = 0.0;
+            for (int j = 0; j < MJ_MAX_JUMPS; ++j)
+                n += U[i] > cdf[j] ? 1.0 : 0.0;
+
+            double x = drift + n * mp.mu_J
+                       + sqrt(var + n * var_J) * Z[i];
+            sum_payoffs += std::max(S0 * exp(x) - K, 0.0);
+        }
+    }
+    *sum += sum_payoffs;
+}
+
+
+inline void run_merton(ui64 num_simulations, ui64 num_runs,
+                       unsigned long long global_seed, double S0, double K,
+                       double T, double r, double q, double sigma)
+{
+    merton_params mp = default_merton_params();
+
+    double k     = exp(mp.mu_J + 0.5 * mp.sigma_J * mp.sigma_J) - 1.0;
+    double drift = (r - q - mp.lambda * k - 0.5 * sigma * sigma) * T;
+    double vol   = sigma * sqrt(T);
+
+    double cdf[MJ_MAX_JUMPS];
+    double p = exp(-mp.lambda * T);
+    cdf[0] = p;
+    for (int n = 1; n < MJ_MAX_JUMPS; ++n)
+    {
+        p *= mp.lambda * T / n;
+        cdf[n] = cdf[n - 1] + p;
+    }
+
+    double sum = 0.0;
+    double t1  = dml_micros();
+
+    int num_threads = get_num_threads();
+    VSLStreamStatePtr parallel_streams[num_threads];
+    init_streams(parallel_streams, num_threads, global_seed,
+                 2 * num_simulations * num_runs);
+
+    #pragma omp parallel default(shared)
+    {
+        double* Z = (double*)malloc(MJ_TILE * sizeof(double));
+        double* U = (double*)malloc(MJ_TILE * sizeof(double));
+        double partial_sum = 0.0;
+        int thread_rank = get_thread_rank();
+
+        #pragma omp for schedule(runtime)
+        for (ui64 run = 0; run < num_runs; ++run)
+        {
+            merton_monte_carlo(S0, K, drift, vol, mp, cdf, num_simulations,
+                               parallel_streams[thread_rank], Z, U,
+                               &partial_sum);
+        }
+
+        free(Z);
+        free(U);
+
+        #pragma omp atomic
+        sum += partial_sum;
+    }
+    delete_streams(parallel_streams, num_threads);
+
+    double t2 = dml_micros();
+    double seconds = (t2 - t1) / 1000000.0;
+    double N = (double)num_simulations * num_runs;
+
+    // Plain GBM, one step
+    double gbm_seconds;
+    run_gbm_stepped(num_simulations, num_runs, global_seed, S0, K, T, r, q,
+                    sigma, 1, &gbm_seconds);
+
+    std::cout << std::fixed << std::setprecision(6);
+    std::cout << " merton value= " << exp(-r * T) * sum / N
+              << " ref= " << merton_call(S0, K, T, r, q, sigma, mp)
+              << std::endl;
+    std::cout << " merton in " << seconds << " seconds, gbm in "
+              << gbm_seconds << " seconds, ratio " << seconds / gbm_seconds
+              << std::endl;
+}
+
+#endif
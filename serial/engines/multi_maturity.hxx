@@ -0,0 +1,131 @@
+// Multi-maturity mode: every path is advanced over the whole maturity grid
+//  with exact GBM increments, so one simulation prices all the expiries
+// A 2Y path goes through every earlier expiry anyway, the call payoff is
+//  just evaluated at each observation point on the way
+
+#ifndef MULTI_MATURITY_HXX
+#define MULTI_MATURITY_HXX
+
+#include <iostream>
+#include <iomanip>
+#include <cmath>
+#include <algorithm>
+
+#include "mc_utils.hxx"
+#include "analytic.hxx"
+#include "curves.hxx"
+
+// Number of paths advanced together
+// The log spot of a tile (SoA) stays in L1 while we walk the grid, and the
+//  normals of a tile are drawn with one RNG call, maturity-major
+#define MM_TILE 512
+
+
+// Adds the sum of (undiscounted) call payoffs of num_simulations paths
+//  at each maturity to sums[j]
+// drift[j] and vol[j] are the exact GBM increment between maturity j - 1
+//  and maturity j (see curve_step_tables)
+// Z_tile must hold MM_TILE * num_maturities doubles, log_S MM_TILE doubles
+inline void multi_maturity_monte_carlo(double S0, double K, int num_maturities,
+                                       const double* drift, const double* vol,
+                                       ui64 num_simulations,
+                                       VSLStreamStatePtr stream, double* Z_tile,
+                                       double* log_S, double* sums)
+{
+    for (ui64 start = 0; start < num_simulations; start += MM_TILE)
+    {
+        ui64 len = std::min((ui64)MM_TILE, num_simulations - start);
+        gaussian_armpl(len * num_maturities, Z_tile, stream);
+
+        for (ui64 i = 0; i < len; ++i)
+        {
+            log_S[i] = 0.0;
+        }
+        for (int j = 0; j < num_maturities; ++j)
+        {
+            const double* Z = Z_tile + j * len;
+            double d = drift[j];
+            double v = vol[j];
+            double sum_payoffs = 0.0;
+            for (ui64 i = 0; i < len; ++i)
+            {
+                log_S[i] += d + v * Z[i];
+                double ST = (S0 * exp(log_S[i])) - K;
+                sum_payoffs += std::max(ST, 0.0);
+            }
+            sums[j] += sum_payoffs;
+        }
+    }
+}
+
+
+// The reference of each maturity is BSM with the average r and q and the
+//  root mean square sigma up to it, exact for deterministic curves
+inline void run_multi_maturity(ui64 num_simulations, ui64 num_runs,
+                               unsigned long long global_seed, double S0,
+                               double K, const curve& r, const curve& q,
+                               const curve& sigma)
+{
+    // Maturity grid: 1M, 3M, 6M, 1Y, 2Y
+    const int num_maturities = 5;
+    const double maturities[num_maturities] = {1.0 / 12.0, 0.25, 0.5,
+                                               1.0, 2.0};
+
+    double drift[num_maturities];
+    double vol[num_maturities];
+    curve_step_tables(r, q, sigma, maturities, num_maturities, drift, vol);
+
+    double sums[num_maturities] = {0.0};
+    double t1 = dml_micros();
+
+    int num_threads = get_num_threads();
+    VSLStreamStatePtr parallel_streams[num_threads];
+    init_streams(parallel_streams, num_threads, global_seed,
+                 num_simulations * num_runs * num_maturities);
+
+    #pragma omp parallel default(shared)
+    {
+        double* Z_tile = (double*)malloc(MM_TILE * num_maturities
+                                         * sizeof(double));
+        double* log_S  = (double*)malloc(MM_TILE * sizeof(double));
+        double partial_sums[num_maturities] = {0.0};
+        int thread_rank = get_thread_rank();
+
+        #pragma omp for schedule(runtime)
+        for (ui64 run = 0; run < num_runs; ++run)
+        {
+            multi_maturity_monte_carlo(S0, K, num_maturities, drift, vol,
+                                       num_simulations,
+                                       parallel_streams[thread_rank],
+                                       Z_tile, log_S, partial_sums);
+        }
+
+        free(Z_tile);
+        free(log_S);
+
+        for (int j = 0; j < num_maturities; ++j)
+        {
+            #pragma omp atomic
+            sums[j] += partial_sums[j];
+        }
+    }
+    delete_streams(parallel_streams, num_threads);
+
+    double t2 = dml_micros();
+    std::cout << std::fixed << std::setprecision(6);
+    for (int j = 0; j < num_maturities; ++j)
+    {
+        double T     = maturities[j];
+        double value = curve_discount(r, T) * sums[j]
+                       / ((double)num_simulations * num_runs);
+        double r_avg = curve_integral(r, T) / T;
+        double q_avg = curve_integral(q, T) / T;
+        double sigma_rms = sqrt(curve_integral_sq(sigma, T) / T);
+        std::cout << " T= " << T << " value= " << value << " ref= "
+                  << black_scholes_call(S0, K, T, r_avg, q_avg, sigma_rms)
+                  << std::endl;
+    }
+    std::cout << " in " << (t2-t1)/1000000.0 << " seconds" << std::endl;
+}
+
+#endif
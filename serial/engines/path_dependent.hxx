@@ -0,0 +1,205 @@
+// Path dependent mode: arithmetic and geometric Asian calls and lookbacks
+//  over daily monitoring (252 steps)
+// Paths are never stored, each path keeps its running statistics (log
+//  spot, sum of spots, sum of log spots, min and max of the log spot) in a
+//  tile of PD_TILE paths (SoA, stays in L1)
+// The normals of a tile are drawn time-major with one RNG call, so the
+//  252 x N normals stream through the cache once
+
+#ifndef PATH_DEPENDENT_HXX
+#define PATH_DEPENDENT_HXX
+
+#include <iostream>
+#include <iomanip>
+#include <cmath>
+#include <algorithm>
+
+#include "mc_utils.hxx"
+#include "analytic.hxx"
+
+// 252 x 64 normals = 126 kB per tile
+#define PD_TILE 64
+
+#define PD_NUM_PRODUCTS 5
+#define PD_ARITH     0      // (mean(S) - K)+
+#define PD_GEO       1      // (geomean(S) - K)+
+#define PD_FLOAT_LB  2      // ST - min(S)
+#define PD_FIXED_LB  3      // (max(S) - K)+
+#define PD_ARITH_CV  4      // arith - geo, the control variate estimator
+
+const char* const pd_names[PD_NUM_PRODUCTS] = {"asian_arith", "asian_geo",
+                                               "lookback_float",
+                                               "lookback_fixed",
+                                               "asian_arith_cv"};
+
+
+// Geometric average Asian call, discrete monitoring at i T / n, i = 1..n
+// Used as validation of the engine and as control variate for the
+//  arithmetic Asian
+inline double geometric_asian_call(double S0, double K, double T, double r,
+                                   double q, double sigma, int n)
+{
+    double mu  = log(S0) + (r - q - 0.5 * sigma * sigma) * T
+                 * (n + 1.0) / (2.0 * n);
+    double var = sigma * sigma * T * (n + 1.0) * (2.0 * n + 1.0)
+                 / (6.0 * n * n);
+    double sd  = sqrt(var);
+    double d1  = (mu - log(K) + var) / sd;
+    double d2  = d1 - sd;
+    return exp(-r * T) * (exp(mu + 0.5 * var) * norm_cdf(d1)
+                          - K * norm_cdf(d2));
+}
+
+
+// Adds the sums and sums of squares of the undiscounted payoffs of
+//  num_simulations paths of num_steps steps
+// Z_tile must hold PD_TILE * num_steps doubles, state 5 * PD_TILE doubles
+inline void path_dependent_monte_carlo(double S0, double K, int num_steps,
+                                       double drift, double vol,
+                                       ui64 num_simulations,
+                                       VSLStreamStatePtr stream, double* Z_tile,
+                                       double* state, double* sums,
+                                       double* sums_sq)
+{
+    double* log_S   = state;
+    double* sum_S   = state + PD_TILE;
+    double* sum_log = state + 2 * PD_TILE;
+    double* min_log = state + 3 * PD_TILE;
+    double* max_log = state + 4 * PD_TILE;
+    double log_S0   = log(S0);
+    double inv_n    = 1.0 / num_steps;
+
+    for (ui64 start = 0; start < num_simulations; start += PD_TILE)
+    {
+        ui64 len = std::min((ui64)PD_TILE, num_simulations - start);
+        gaussian_armpl(len * num_steps, Z_tile, stream);
+
+        for (ui64 i = 0; i < len; ++i)
+        {
+            log_S[i]   = log_S0;
+            sum_S[i]   = 0.0;
+            sum_log[i] = 0.0;
+            min_log[i] = log_S0;
+            max_log[i] = log_S0;
+        }
+
+        for (int t = 0; t < num_steps; ++t)
+        {
+            const double* Z = Z_tile + t * len;
+            for (ui64 i = 0; i < len; ++i)
+            {
+                double x   = log_S[i] + drift + vol * Z[i];
+                log_S[i]   = x;
+                sum_S[i]  += exp(x);
+                sum_log[i] += x;
+                min_log[i] = std::min(min_log[i], x);
+                max_log[i] = std::max(max_log[i], x);
+            }
+        }
+
+        double s[PD_NUM_PRODUCTS] = {0.0};
+        double s2[PD_NUM_PRODUCTS] = {0.0};
+        for (ui64 i = 0; i < len; ++i)
+        {
+            double ST = exp(log_S[i]);
+            double p[PD_NUM_PRODUCTS];
+            p[PD_ARITH]    = std::max(sum_S[i] * inv_n - K, 0.0);
+            p[PD_GEO]      = std::max(exp(sum_log[i] * inv_n) - K, 0.0);
+            p[PD_FLOAT_LB] = ST - exp(min_log[i]);
+            p[PD_FIXED_LB] = std::max(exp(max_log[i]) - K, 0.0);
+            p[PD_ARITH_CV] = p[PD_ARITH] - p[PD_GEO];
+            for (int k = 0; k < PD_NUM_PRODUCTS; ++k)
+            {
+                s[k]  += p[k];
+                s2[k] += p[k] * p[k];
+            }
+        }
+        for (int k = 0; k < PD_NUM_PRODUCTS; ++k)
+        {
+            sums[k]    += s[k];
+            sums_sq[k] += s2[k];
+        }
+    }
+}
+
+
+inline void run_path_dependent(ui64 num_simulations, ui64 num_runs,
+                               unsigned long long global_seed, double S0,
+                               double K, double T, double r, double q,
+                               double sigma)
+{
+    const int num_steps = 252;      // Daily monitoring
+    double dt    = T / num_steps;
+    double drift = (r - q - 0.5 * sigma * sigma) * dt;
+    double vol   = sigma * sqrt(dt);
+
+    double sums[PD_NUM_PRODUCTS]    = {0.0};
+    double sums_sq[PD_NUM_PRODUCTS] = {0.0};
+    double t1 = dml_micros();
+
+    int num_threads = get_num_threads();
+    VSLStreamStatePtr parallel_streams[num_threads];
+    init_streams(parallel_streams, num_threads, global_seed,
+                 num_simulations * num_runs * num_steps);
+
+    #pragma omp parallel default(shared)
+    {
+        double* Z_tile = (double*)malloc(PD_TILE * num_steps
+                                         * sizeof(double));
+        double* state  = (double*)malloc(5 * PD_TILE * sizeof(double));
+        double partial_sums[PD_NUM_PRODUCTS]    = {0.0};
+        double partial_sums_sq[PD_NUM_PRODUCTS] = {0.0};
+        int thread_rank = get_thread_rank();
+
+        #pragma omp for schedule(runtime)
+        for (ui64 run = 0; run < num_runs; ++run)
+        {
+            path_dependent_monte_carlo(S0, K, num_steps, drift, vol,
+                                       num_simulations,
+                                       parallel_streams[thread_rank],
+                                       Z_tile, state, partial_sums,
+                                       partial_sums_sq);
+        }
+
+        free(Z_tile);
+        free(state);
+
+        for (int k = 0; k < PD_NUM_PRODUCTS; ++k)
+        {
+            #pragma omp atomic
+            sums[k] += partial_sums[k];
+            #pragma omp atomic
+            sums_sq[k] += partial_sums_sq[k];
+        }
+    }
+    delete_streams(parallel_streams, num_threads);
+
+    double t2 = dml_micros();
+
+    double disc    = exp(-r * T);
+    double N       = (double)num_simulations * num_runs;
+    double geo_ref = geometric_asian_call(S0, K, T, r, q, sigma, num_steps);
+
+    std::cout << std::fixed << std::setprecision(6);
+    for (int k = 0; k < PD_NUM_PRODUCTS; ++k)
+    {
+        double mean   = sums[k] / N;
+        double var    = std::max(sums_sq[k] / N - mean * mean, 0.0);
+        double value  = disc * mean;
+        // arith_cv = E[arith - geo] + analytic geo
+        if (k == PD_ARITH_CV)
+        {
+            value += geo_ref;
+        }
+        std::cout << " " << pd_names[k] << " value= " << value
+                  << " stderr= " << disc * sqrt(var / N);
+        if (k == PD_GEO)
+        {
+            std::cout << " ref= " << geo_ref;
+        }
+        std::cout << std::endl;
+    }
+    std::cout << " in " << (t2-t1)/1000000.0 << " seconds" << std::endl;
+}
+
+#endif
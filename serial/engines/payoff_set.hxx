@@ -0,0 +1,139 @@
+// Payoff set mode: calls, puts, digitals and forwards priced together
+// The RNG and the exp are what the kernel pays for, so every payoff of the
+//  set is evaluated on the same ST and gets its own accumulator
+
+#ifndef PAYOFF_SET_HXX
+#define PAYOFF_SET_HXX
+
+#include <iostream>
+#include <iomanip>
+#include <cmath>
+#include <algorithm>
+
+#include "mc_utils.hxx"
+#include "analytic.hxx"
+
+#define NUM_PAYOFFS 5
+
+// Each product of the set has its own strike
+struct payoff_set
+{
+    double K_call;
+    double K_put;
+    double K_cash;      // cash-or-nothing call, pays cash if ST > K_cash
+    double cash;
+    double K_asset;     // asset-or-nothing call, pays ST if ST > K_asset
+    double K_forward;   // pays ST - K_forward
+};
+
+const char* const payoff_names[NUM_PAYOFFS] = {"call", "put",
+                                               "cash_digital",
+                                               "asset_digital", "forward"};
+
+
+// Same as black_scholes_monte_carlo but evaluates the whole payoff set on
+//  each ST, sums[p] receives the undiscounted sum of payoff p
+// drift = (r - q - sigma^2 / 2) * T and vol = sigma * sqrt(T)
+inline void black_scholes_monte_carlo_payoffs(double S0, const payoff_set& set,
+                                              ui64 num_simulations,
+                                              double drift, double vol,
+                                              VSLStreamStatePtr stream,
+                                              double* Z_tab, double* sums)
+{
+    gaussian_armpl(num_simulations, Z_tab, stream);
+
+    // Local copies so the compiler keeps everything in registers
+    const double K_call = set.K_call, K_put = set.K_put;
+    const double K_cash = set.K_cash, cash = set.cash;
+    const double K_asset = set.K_asset;
+    double sum_call = 0.0, sum_put = 0.0, sum_cash = 0.0, sum_asset = 0.0;
+    double sum_forward = 0.0;
+
+    for (ui64 i = 0; i < num_simulations; ++i)
+    {
+        double ST = S0 * exp(drift + vol * Z_tab[i]);
+        sum_call    += std::max(ST - K_call, 0.0);
+        sum_put     += std::max(K_put - ST, 0.0);
+        sum_cash    += ST > K_cash ? cash : 0.0;
+        sum_asset   += ST > K_asset ? ST : 0.0;
+        sum_forward += ST;
+    }
+
+    sums[0] += sum_call;
+    sums[1] += sum_put;
+    sums[2] += sum_cash;
+    sums[3] += sum_asset;
+    // The strike of the forward is constant, no need to subtract it per path
+    sums[4] += sum_forward - set.K_forward * num_simulations;
+}
+
+
+inline void run_payoff_set(ui64 num_simulations, ui64 num_runs,
+                           unsigned long long global_seed, double S0, double K,
+                           double T, double r, double q, double sigma)
+{
+    payoff_set set;
+    set.K_call    = K;
+    set.K_put     = K;
+    set.K_cash    = K;
+    set.cash      = 10.0;
+    set.K_asset   = K;
+    set.K_forward = K;
+
+    double drift = (r - q - 0.5 * sigma * sigma) * T;
+    double vol   = sigma * sqrt(T);
+
+    double sums[NUM_PAYOFFS] = {0.0};
+    double t1 = dml_micros();
+
+    int num_threads = get_num_threads();
+    VSLStreamStatePtr parallel_streams[num_threads];
+    init_streams(parallel_streams, num_threads, global_seed,
+                 num_simulations * num_runs);
+
+    #pragma omp parallel default(shared)
+    {
+        double* Z_tab = (double*)malloc(num_simulations * sizeof(double));
+        double partial_sums[NUM_PAYOFFS] = {0.0};
+        int thread_rank = get_thread_rank();
+
+        #pragma omp for schedule(runtime)
+        for (ui64 run = 0; run < num_runs; ++run)
+        {
+            black_scholes_monte_carlo_payoffs(S0, set, num_simulations,
+                                              drift, vol,
+                                              parallel_streams[thread_rank],
+                                              Z_tab, partial_sums);
+        }
+
+        free(Z_tab);
+
+        for (int p = 0; p < NUM_PAYOFFS; ++p)
+        {
+            #pragma omp atomic
+            sums[p] += partial_sums[p];
+        }
+    }
+    delete_streams(parallel_streams, num_threads);
+
+    double t2 = dml_micros();
+
+    double refs[NUM_PAYOFFS];
+    refs[0] = black_scholes_call(S0, set.K_call, T, r, q, sigma);
+    refs[1] = black_scholes_put(S0, set.K_put, T, r, q, sigma);
+    refs[2] = cash_or_nothing_call(S0, set.K_cash, set.cash, T, r, q, sigma);
+    refs[3] = asset_or_nothing_call(S0, set.K_asset, T, r, q, sigma);
+    refs[4] = forward_value(S0, set.K_forward, T, r, q);
+
+    std::cout << std::fixed << std::setprecision(6);
+    for (int p = 0; p < NUM_PAYOFFS; ++p)
+    {
+        double value = exp(-r * T) * sums[p]
+                       / ((double)num_simulations * num_runs);
+        std::cout << " " << payoff_names[p] << " value= " << value
+                  << " ref= " << refs[p] << std::endl;
+    }
+    std::cout << " in " << (t2-t1)/1000000.0 << " seconds" << std::endl;
+}
+
+#endif
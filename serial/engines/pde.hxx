@@ -0,0 +1,280 @@
+// PDE mode: Crank-Nicolson finite differences on a log spot grid, with
+//  Rannacher smoothing (the first two steps are replaced by four implicit
+//  Euler half steps, which damps the payoff kink)
+// In time to maturity tau and x = ln S
+//      u_tau = 1/2 sigma^2 u_xx + (r - q - 1/2 sigma^2) u_x - r u
+// PDE_LANES contracts are solved at once, every grid array is laid out
+//  [node][lane], so the Thomas algorithm loops over nodes with an inner
+//  loop over lanes (SIMD lanes = contracts)
+// Early exercise uses Brennan-Schwartz: the tridiagonal system is
+//  eliminated towards the exercise region and the max with the payoff is
+//  taken during the substitution, exact for puts (and calls) in one sweep
+// A batch shares the option type and style, the contracts can differ in
+//  everything else
+
+#ifndef PDE_HXX
+#define PDE_HXX
+
+#include <iostream>
+#include <iomanip>
+#include <cmath>
+#include <algorithm>
+
+#include "mc_utils.hxx"
+#include "analytic.hxx"
+#include "analytic_batch.hxx"
+#include "american.hxx"
+
+#define PDE_LANES 8
+
+// Half width of the grid in standard deviations
+#define PDE_WIDTH 5.0
+
+// Grid arrays needed by crank_nicolson_batch, in doubles
+#define PDE_WORK_SIZE(num_nodes) (5 * (num_nodes) * PDE_LANES)
+
+
+// Prices PDE_LANES contracts, num_nodes must be odd so the spot is the
+//  middle node, cp = 1 for calls and -1 for puts
+inline void crank_nicolson_batch(const double* S0, const double* K,
+                                 const double* T, const double* r,
+                                 const double* q, const double* sigma,
+                                 double cp, bool american, int num_nodes,
+                                 int num_steps, double* work, double* price)
+{
+    const int L = PDE_LANES;
+    const int N = num_nodes;
+    double* u      = work;                  // Values
+    double* payoff = work + N * L;
+    double* rhs    = work + 2 * N * L;
+    double* c_tmp  = work + 3 * N * L;      // Thomas coefficients
+    double* d_tmp  = work + 4 * N * L;
+
+    // Per lane grid and operator coefficients
+    double dx[L], dt[L], a[L], b[L], c[L], S_min[L], S_max[L];
+    for (int l = 0; l < L; ++l)
+    {
+        double width = PDE_WIDTH * sigma[l] * sqrt(T[l]);
+        dx[l] = 2.0 * width / (N - 1);
+        dt[l] = T[l] / num_steps;
+        double nu  = r[l] - q[l] - 0.5 * sigma[l] * sigma[l];
+        double s2  = sigma[l] * sigma[l] / (dx[l] * dx[l]);
+        a[l] = 0.5 * s2 - 0.5 * nu / dx[l];
+        b[l] = -s2 - r[l];
+        c[l] = 0.5 * s2 + 0.5 * nu / dx[l];
+        S_min[l] = S0[l] * exp(-width);
+        S_max[l] = S0[l] * exp(width);
+    }
+    for (int i = 0; i < N; ++i)
+    {
+        for (int l = 0; l < L; ++l)
+        {
+            double S = S0[l] * exp((i - (N - 1) / 2) * dx[l]);
+            payoff[i * L + l] = std::max(cp * (S - K[l]), 0.0);
+            u[i * L + l] = payoff[i * L + l];
+        }
+    }
+
+    // Rannacher: 4 implicit half steps, then Crank-Nicolson
+    int num_sub = num_steps + 2;
+    double tau[L];
+    for (int l = 0; l < L; ++l)
+        tau[l] = 0.0;
+
+    for (int n = 0; n < num_sub; ++n)
+    {
+        bool rannacher = n < 4;
+        double theta   = rannacher ? 1.0 : 0.5;
+        double frac    = rannacher ? 0.5 : 1.0;
+
+        double A[L], B[L], C[L], lo[L], hi[L];
+        for (int l = 0; l < L; ++l)
+        {
+            double h = frac * dt[l];
+            tau[l] += h;
+            A[l] = -theta * h * a[l];
+            B[l] = 1.0 - theta * h * b[l];
+            C[l] = -theta * h * c[l];
+            // Boundaries at the new time
+            double euro_lo = cp * (S_min[l] * exp(-q[l] * tau[l])
+                                   - K[l] * exp(-r[l] * tau[l]));
+            double euro_hi = cp * (S_max[l] * exp(-q[l] * tau[l])
+                                   - K[l] * exp(-r[l] * tau[l]));
+            lo[l] = std::max(euro_lo, american ? payoff[l] : 0.0);
+            hi[l] = std::max(euro_hi,
+                             american ? payoff[(N - 1) * L + l] : 0.0);
+        }
+
+        // Explicit part
+        for (int i = 1; i < N - 1; ++i)
+        {
+            for (int l = 0; l < L; ++l)
+            {
+                double h = (1.0 - theta) * frac * dt[l];
+                rhs[i * L + l] = u[i * L + l]
+                                 + h * (a[l] * u[(i - 1) * L + l]
+                                        + b[l] * u[i * L + l]
+                                        + c[l] * u[(i + 1) * L + l]);
+            }
+        }
+        for (int l = 0; l < L; ++l)
+        {
+            u[l] = lo[l];
+            u[(N - 1) * L + l] = hi[l];
+            rhs[L + l]           -= A[l] * lo[l];
+            rhs[(N - 2) * L + l] -= C[l] * hi[l];
+        }
+
+        if (cp < 0.0)
+        {
+            // Puts: eliminate from the top, substitute upwards from the
+            //  exercise region
+            for (int l = 0; l < L; ++l)
+            {
+                int i = N - 2;
+                c_tmp[i * L + l] = A[l] / B[l];
+                d_tmp[i * L + l] = rhs[i * L + l] / B[l];
+            }
+            for (int i = N - 3; i >= 1; --i)
+            {
+                for (int l = 0; l < L; ++l)
+                {
+                    double m = 1.0 / (B[l] - C[l] * c_tmp[(i + 1) * L + l]);
+                    c_tmp[i * L + l] = A[l] * m;
+                    d_tmp[i * L + l] = (rhs[i * L + l]
+                                        - C[l] * d_tmp[(i + 1) * L + l]) * m;
+                }
+            }
+            for (int i = 1; i < N - 1; ++i)
+            {
+                for (int l = 0; l < L; ++l)
+                {
+                    double v = d_tmp[i * L + l]
+                               - c_tmp[i * L + l] * u[(i - 1) * L + l];
+                    u[i * L + l] = american ? std::max(v, payoff[i * L + l])
+                                            : v;
+                }
+            }
+        }
+        else
+        {
+            // Calls: usual Thomas, substitute downwards
+            for (int l = 0; l < L; ++l)
+            {
+                c_tmp[L + l] = C[l] / B[l];
+                d_tmp[L + l] = rhs[L + l] / B[l];
+            }
+            for (int i = 2; i < N - 1; ++i)
+            {
+                for (int l = 0; l < L; ++l)
+                {
+                    double m = 1.0 / (B[l] - A[l] * c_tmp[(i - 1) * L + l]);
+                    c_tmp[i * L + l] = C[l] * m;
+                    d_tmp[i * L + l] = (rhs[i * L + l]
+                                        - A[l] * d_tmp[(i - 1) * L + l]) * m;
+                }
+            }
+            for (int i = N - 2; i >= 1; --i)
+            {
+                for (int l = 0; l < L; ++l)
+                {
+                    double v = d_tmp[i * L + l]
+                               - c_tmp[i * L + l] * u[(i + 1) * L + l];
+                    u[i * L + l] = american ? std::max(v, payoff[i * L + l])
+                                            : v;
+                }
+            }
+        }
+    }
+
+    for (int l = 0; l < L; ++l)
+        price[l] = u[((N - 1) / 2) * L + l];
+}
+
+
+// Prices the whole batch PDE_LANES contracts at a time, in parallel
+inline void crank_nicolson_contracts(const contract_batch& c, double cp,
+                                     bool american, int num_nodes,
+                                     int num_steps, double* price)
+{
+    ui64 num_batches = (c.n + PDE_LANES - 1) / PDE_LANES;
+    #pragma omp parallel default(shared)
+    {
+        double* work = (double*)malloc(PDE_WORK_SIZE(num_nodes)
+                                       * sizeof(double));
+        #pragma omp for schedule(dynamic)
+        for (ui64 batch = 0; batch < num_batches; ++batch)
+        {
+            // The last batch is padded with copies of its first contract
+            double S0[PDE_LANES], K[PDE_LANES], T[PDE_LANES], r[PDE_LANES];
+            double q[PDE_LANES], sigma[PDE_LANES], out[PDE_LANES];
+            ui64 first = batch * PDE_LANES;
+            for (int l = 0; l < PDE_LANES; ++l)
+            {
+                ui64 i = first + l < c.n ? first + l : first;
+                S0[l] = c.S[i];  K[l] = c.K[i];  T[l] = c.T[i];
+                r[l]  = c.r[i];  q[l] = c.q[i];  sigma[l] = c.sigma[i];
+            }
+            crank_nicolson_batch(S0, K, T, r, q, sigma, cp, american,
+                                 num_nodes, num_steps, work, out);
+            for (int l = 0; l < PDE_LANES && first + l < c.n; ++l)
+                price[first + l] = out[l];
+        }
+        free(work);
+    }
+}
+
+
+// num_simulations random contracts priced as European calls and as
+//  American puts, num_runs times
+inline void run_pde(ui64 num_simulations, ui64 num_runs,
+                    unsigned long long global_seed)
+{
+    const int num_nodes = 401;
+    const int num_steps = 200;
+    // Trees are slow, only the first contracts are checked
+    const ui64 num_checked = std::min(num_simulations, (ui64)64);
+
+    contract_batch c = alloc_contracts(num_simulations);
+    random_contracts(c, global_seed);
+    double* call = (double*)malloc(num_simulations * sizeof(double));
+    double* put  = (double*)malloc(num_simulations * sizeof(double));
+
+    double t1 = dml_micros();
+    for (ui64 run = 0; run < num_runs; ++run)
+    {
+        crank_nicolson_contracts(c, 1.0, false, num_nodes, num_steps, call);
+        crank_nicolson_contracts(c, -1.0, true, num_nodes, num_steps, put);
+    }
+    double t2 = dml_micros();
+
+    double max_call_error = 0.0, max_put_error = 0.0;
+    for (ui64 i = 0; i < c.n; ++i)
+    {
+        double ref = black_scholes_call(c.S[i], c.K[i], c.T[i], c.r[i],
+                                        c.q[i], c.sigma[i]);
+        max_call_error = std::max(max_call_error, fabs(call[i] - ref));
+    }
+    for (ui64 i = 0; i < num_checked; ++i)
+    {
+        double ref = crr_american_put(c.S[i], c.K[i], c.T[i], c.r[i],
+                                      c.q[i], c.sigma[i], 2000);
+        max_put_error = std::max(max_put_error, fabs(put[i] - ref));
+    }
+
+    double seconds = (t2 - t1) / 1000000.0;
+    std::cout << std::fixed << std::setprecision(6);
+    std::cout << " european call max error= " << max_call_error
+              << " american put max error= " << max_put_error << " (first "
+              << num_checked << " against a tree)" << std::endl;
+    std::cout << " " << 2 * c.n * num_runs << " contracts (" << num_nodes
+              << " nodes, " << num_steps << " steps) in " << seconds
+              << " seconds, " << 2 * c.n * num_runs / seconds
+              << " contracts/s" << std::endl;
+
+    free(call);
+    free(put);
+    free_contracts(c);
+}
+
+#endif
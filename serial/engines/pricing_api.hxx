@@ -0,0 +1,224 @@
+// Plug-in API: models, payoffs and normal samplers as C++20 concepts, and
+//  one templated driver that fuses them into a single loop
+//      Sampler: s.normals(n, Z) fills Z with n standard normals
+//      Model:   M::num_normals normals per path, m.terminal(Z, i, n) is
+//               the spot at maturity of path i (normal k of the path is
+//               Z[k * n + i]), m.discount() the discount factor
+//      Payoff:  p(ST) is the payoff
+// Everything is resolved at compile time: the driver is instantiated for
+//  the three types and the calls are inlined, no virtual call or function
+//  pointer is left in the loop
+// The GBM model, the call payoff and the OpenRNG sampler are what the call
+//  mode runs (black_scholes_monte_carlo, the hand written kernel, is left
+//  for the sketch mode), the plugin mode checks the driver against that
+//  kernel on the same normals
+// A new product is a struct with an operator() (see put_payoff,
+//  digital_payoff), a new model a struct with terminal and discount, used
+//  from an engine header without touching BSM.cxx' kernel
+// Needs -std=c++20 (in the Makefile lines)
+
+#ifndef PRICING_API_HXX
+#define PRICING_API_HXX
+
+#include <iostream>
+#include <iomanip>
+#include <concepts>
+#include <cmath>
+#include <algorithm>
+
+#include "mc_utils.hxx"
+#include "analytic.hxx"
+
+template <class S>
+concept Sampler = requires(S s, ui64 n, double* Z)
+{
+    s.normals(n, Z);
+};
+
+template <class M>
+concept Model = requires(const M m, const double* Z, ui64 i, ui64 n)
+{
+    { M::num_normals } -> std::convertible_to<int>;
+    { m.terminal(Z, i, n) } -> std::convertible_to<double>;
+    { m.discount() } -> std::convertible_to<double>;
+};
+
+template <class P>
+concept Payoff = requires(const P p, double ST)
+{
+    { p(ST) } -> std::convertible_to<double>;
+};
+
+
+// Samplers
+
+// OpenRNG stream (one per thread, see init_streams)
+struct openrng_sampler
+{
+    VSLStreamStatePtr stream;
+
+    void normals(ui64 n, double* Z)
+    {
+        gaussian_armpl(n, Z, stream);
+    }
+};
+
+
+// Models
+
+// Black-Scholes: S_T = S0 exp(drift + vol Z), drift and vol integrated
+//  over [0, T] (see integrated_drift_vol)
+struct gbm_model
+{
+    static constexpr int num_normals = 1;
+    double S0, drift, vol, df;
+
+    double terminal(const double* Z, ui64 i, ui64 /* n */) const
+    {
+        return S0 * exp(drift + vol * Z[i]);
+    }
+    double discount() const { return df; }
+};
+
+
+// Payoffs
+
+struct call_payoff
+{
+    double K;
+    double operator()(double ST) const { return std::max(ST - K, 0.0); }
+};
+
+struct put_payoff
+{
+    double K;
+    double operator()(double ST) const { return std::max(K - ST, 0.0); }
+};
+
+// Pays cash if ST > K
+struct digital_payoff
+{
+    double K, cash;
+    double operator()(double ST) const { return ST > K ? cash : 0.0; }
+};
+
+static_assert(Sampler<openrng_sampler>);
+static_assert(Model<gbm_model>);
+static_assert(Payoff<call_payoff> && Payoff<put_payoff>
+              && Payoff<digital_payoff>);
+
+
+// Discounted mean payoff of num_simulations paths, Z must hold
+//  M::num_normals * num_simulations doubles
+template <Model M, Payoff P, Sampler S>
+inline double price_fused(const M& model, const P& payoff, S& sampler,
+                          ui64 num_simulations, double* Z)
+{
+    sampler.normals(M::num_normals * num_simulations, Z);
+    double sum_payoffs = 0.0;
+    for (ui64 i = 0; i < num_simulations; ++i)
+        sum_payoffs += payoff(model.terminal(Z, i, num_simulations));
+    return sum_payoffs * (model.discount() / num_simulations);
+}
+
+// Mean over num_runs runs, one sampler per thread built from its stream
+template <Model M, Payoff P>
+inline double price_runs(const M& model, const P& payoff, ui64 num_simulations,
+                         ui64 num_runs, unsigned long long global_seed)
+{
+    double sum = 0.0;
+    int num_threads = get_num_threads();
+    VSLStreamStatePtr parallel_streams[num_threads];
+    ui64 skip = ((num_simulations * num_runs) / num_threads)
+                + (num_simulations * num_runs);
+    init_streams(parallel_streams, num_threads, global_seed,
+                 M::num_normals * skip);
+
+    #pragma omp parallel default(shared)
+    {
+        double* Z = (double*)malloc(M::num_normals * num_simulations
+                                    * sizeof(double));
+        openrng_sampler sampler = {parallel_streams[get_thread_rank()]};
+        double partial_sum = 0.0;
+
+        #pragma omp for schedule(runtime)
+        for (ui64 run = 0; run < num_runs; ++run)
+        {
+            partial_sum += price_fused(model, payoff, sampler,
+                                       num_simulations, Z);
+        }
+
+        free(Z);
+
+        #pragma omp atomic
+        sum += partial_sum;
+    }
+    delete_streams(parallel_streams, num_threads);
+    return sum / num_runs;
+}
+
+
+// The call through the driver against the hand written kernel (reference,
+//  black_scholes_monte_carlo, same arguments) on the same normals, then
+//  products that only exist as payoff structs
+template <class Reference>
+inline void run_plugin(ui64 num_simulations, ui64 num_runs,
+                       unsigned long long global_seed, double S0, double K,
+                       double T, double r, double q, double sigma,
+                       Reference reference)
+{
+    double drift = (r - q - 0.5 * sigma * sigma) * T;
+    double vol   = sigma * sqrt(T);
+    gbm_model model = {S0, drift, vol, exp(-r * T)};
+    call_payoff call = {K};
+
+    // Kernel and driver alternate run by run, on two copies of the same
+    //  stream (no skip between them) so they see the same normals
+    double* Z    = (double*)malloc(num_simulations * sizeof(double));
+    double* work = (double*)malloc(num_simulations * sizeof(double));
+    VSLStreamStatePtr streams[2];
+    init_streams(streams, 2, global_seed, 0);
+    openrng_sampler sampler = {streams[1]};
+    double precomputed_return = model.df * (1.0 / num_simulations);
+    double hand = 0.0, fused = 0.0, hand_time = 0.0, fused_time = 0.0;
+    for (ui64 run = 0; run < num_runs; ++run)
+    {
+        double t1 = dml_micros();
+        hand += reference(S0, K, num_simulations, drift, vol,
+                          precomputed_return, streams[0], Z, work, NULL);
+        double t2 = dml_micros();
+        fused += price_fused(model, call, sampler, num_simulations, Z);
+        double t3 = dml_micros();
+        hand_time  += t2 - t1;
+        fused_time += t3 - t2;
+    }
+    delete_streams(streams, 2);
+    free(Z);
+    free(work);
+
+    std::cout << std::fixed << std::setprecision(6);
+    std::cout << " call kernel= " << hand / num_runs << " in "
+              << hand_time / 1000000.0 << " seconds, driver= "
+              << fused / num_runs << " in " << fused_time / 1000000.0
+              << " seconds (x" << fused_time / hand_time << ")" << std::endl;
+
+    // Products added as payoff structs, all threads
+    double t1 = dml_micros();
+    double value_call = price_runs(model, call, num_simulations, num_runs,
+                                   global_seed);
+    double value_put  = price_runs(model, put_payoff{K}, num_simulations,
+                                   num_runs, global_seed);
+    double value_dig  = price_runs(model, digital_payoff{K, 10.0},
+                                   num_simulations, num_runs, global_seed);
+    double t2 = dml_micros();
+    std::cout << " call value= " << value_call << " ref= "
+              << black_scholes_call(S0, K, T, r, q, sigma) << std::endl;
+    std::cout << " put value= " << value_put << " ref= "
+              << black_scholes_put(S0, K, T, r, q, sigma) << std::endl;
+    std::cout << " digital value= " << value_dig << " ref= "
+              << cash_or_nothing_call(S0, K, 10.0, T, r, q, sigma)
+              << std::endl;
+    std::cout << " in " << (t2 - t1) / 1000000.0 << " seconds" << std::endl;
+}
+
+#endif
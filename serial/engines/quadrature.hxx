@@ -0,0 +1,321 @@
+// Quadrature mode: deterministic prices of European payoffs of S_T under
+//  GBM, what black_scholes_monte_carlo estimates is the 1-D integral
+//      e^-rT int f(S0 e^(drift + vol z)) phi(z) dz
+// Smooth payoffs use an n point Gauss-Hermite rule (nodes and weights
+//  mapped to the standard normal, computed once)
+// Payoffs with a kink or a jump (calls, digitals) converge slowly with a
+//  single rule, so the integral is split at the z of the kink and each
+//  piece of [-QUAD_RANGE, QUAD_RANGE] gets n / 2 Gauss-Legendre points:
+//  the integrand is smooth on both sides and the error is back to
+//  spectral; without a kink inside the range (log contract, far strikes)
+//  the integrand is smooth and the split rule falls back on Gauss-Hermite
+// The payoff is a template parameter, any type with
+//      double operator()(double ST, double K) const
+//      double kink(double K) const     // S_T of the kink, 0 if none
+//  contracts are evaluated in an "omp parallel for simd" loop, the nodes
+//  are the inner loop
+
+#ifndef QUADRATURE_HXX
+#define QUADRATURE_HXX
+
+#include <iostream>
+#include <iomanip>
+#include <cmath>
+#include <algorithm>
+
+#include "mc_utils.hxx"
+#include "analytic.hxx"
+#include "analytic_batch.hxx"
+
+// Integration range of the split rule, in standard deviations (the normal
+//  density is ~1e-22 there)
+#define QUAD_RANGE 10.0
+#define QUAD_MAX_NODES 256
+
+struct quad_rule
+{
+    int     n;
+    double  gh_z[QUAD_MAX_NODES];       // Gauss-Hermite, standard normal
+    double  gh_w[QUAD_MAX_NODES];
+    int     n_gl;
+    double  gl_x[QUAD_MAX_NODES / 2];   // Gauss-Legendre on [-1, 1]
+    double  gl_w[QUAD_MAX_NODES / 2];
+};
+
+
+// Gauss-Hermite for the weight e^(-x^2), Newton on the orthonormal Hermite
+//  recurrence (Numerical Recipes' gauher)
+// The recurrence runs on the Hermite functions (polynomials times
+//  e^(-x^2 / 2)), the plain polynomials overflow past ~150 nodes, and the
+//  weights 2 e^(-x^2) / p'(x)^2 are formed in log space, the outermost ones
+//  underflow to 0 (they are below 1e-308 anyway)
+// The guesses of gauher are poor past ~150 nodes, Newton also runs on
+//  p / prod (x - x_k) over the roots +-x_k already found (deflation) so it
+//  cannot converge back to one of them
+inline void gauss_hermite(int n, double* x, double* w)
+{
+    const double pim4 = 0.7511255444649425;     // pi^(-1/4)
+    double z = 0.0;
+    for (int i = 0; i < (n + 1) / 2; ++i)
+    {
+        // Largest roots from the zeros a_k of the Airy function,
+        //  sqrt(2n+1) - 2^(-1/3) |a_k| (2n+1)^(-1/6), then extrapolated
+        //  from the previous ones
+        if (i < 4)
+        {
+            double t = 3.0 * M_PI * (4.0 * i + 3.0) / 8.0;
+            double a = pow(t, 2.0 / 3.0) * (1.0 + 5.0 / (48.0 * t * t));
+            z = sqrt(2.0 * n + 1.0)
+                - 0.7937005259840998 * a * pow(2.0 * n + 1.0, -1.0 / 6.0);
+        }
+        else
+            z = 2.0 * z - x[i - 2];
+        double pp = 0.0;
+        for (int it = 0; it < 100; ++it)
+        {
+            double p1 = pim4 * exp(-0.5 * z * z), p2 = 0.0;
+            for (int j = 1; j <= n; ++j)
+            {
+                double p3 = p2;
+                p2 = p1;
+                p1 = z * sqrt(2.0 / j) * p2 - sqrt((j - 1.0) / j) * p3;
+            }
+            pp = sqrt(2.0 * n) * p2;
+            double deflation = 0.0;
+            for (int k = 0; k < i; ++k)
+                deflation += 1.0 / (z - x[k]) + 1.0 / (z + x[k]);
+            double z1 = z;
+            z = z1 - p1 / (pp - p1 * deflation);
+            if (fabs(z - z1) <= 1e-15 * fabs(z))
+                break;
+        }
+        x[i] = z;
+        x[n - 1 - i] = -z;
+        w[i] = exp(M_LN2 - z * z - 2.0 * log(fabs(pp)));
+        w[n - 1 - i] = w[i];
+    }
+}
+
+// Gauss-Legendre on [-1, 1] (Numerical Recipes' gauleg)
+inline void gauss_legendre(int n, double* x, double* w)
+{
+    for (int i = 0; i < (n + 1) / 2; ++i)
+    {
+        double z = cos(M_PI * (i + 0.75) / (n + 0.5));
+        double pp = 0.0;
+        for (int it = 0; it < 100; ++it)
+        {
+            double p1 = 1.0, p2 = 0.0;
+            for (int j = 1; j <= n; ++j)
+            {
+                double p3 = p2;
+                p2 = p1;
+                p1 = ((2.0 * j - 1.0) * z * p2 - (j - 1.0) * p3) / j;
+            }
+            pp = n * (z * p1 - p2) / (z * z - 1.0);
+            double z1 = z;
+            z = z1 - p1 / pp;
+            if (fabs(z - z1) <= 1e-15)
+                break;
+        }
+        x[i] = -z;
+        x[n - 1 - i] = z;
+        w[i] = 2.0 / ((1.0 - z * z) * pp * pp);
+        w[n - 1 - i] = w[i];
+    }
+}
+
+// n between 2 and QUAD_MAX_NODES
+inline void make_quad_rule(int n, quad_rule& rule)
+{
+    rule.n    = n;
+    rule.n_gl = n / 2;
+    gauss_hermite(n, rule.gh_z, rule.gh_w);
+    for (int i = 0; i < n; ++i)
+    {
+        // e^(-x^2) -> standard normal: z = sqrt(2) x, w / sqrt(pi)
+        rule.gh_z[i] *= M_SQRT2;
+        rule.gh_w[i] *= 0.5641895835477563;
+    }
+    gauss_legendre(rule.n_gl, rule.gl_x, rule.gl_w);
+}
+
+
+// Price of one contract, split selects the kink aware rule
+template <class Payoff>
+inline double quadrature_price(const Payoff& payoff, double S0, double K,
+                               double T, double r, double q, double sigma,
+                               const quad_rule& rule, bool split)
+{
+    double drift = (r - q - 0.5 * sigma * sigma) * T;
+    double vol   = sigma * sqrt(T);
+    double sum   = 0.0;
+
+    // z of the kink, split only if it is inside the range: a clamped z_k
+    //  would leave one piece of zero width and half of the nodes unused
+    double kink = payoff.kink(K);
+    double z_k  = (log(std::max(kink, 1e-300) / S0) - drift) / vol;
+    if (split && z_k > -QUAD_RANGE && z_k < QUAD_RANGE)
+    {
+        double mid_lo  = 0.5 * (z_k - QUAD_RANGE);
+        double half_lo = 0.5 * (z_k + QUAD_RANGE);
+        double mid_hi  = 0.5 * (z_k + QUAD_RANGE);
+        double half_hi = 0.5 * (QUAD_RANGE - z_k);
+        for (int k = 0; k < rule.n_gl; ++k)
+        {
+            double z_lo = mid_lo + half_lo * rule.gl_x[k];
+            double z_hi = mid_hi + half_hi * rule.gl_x[k];
+            double f_lo = payoff(S0 * exp(drift + vol * z_lo), K);
+            double f_hi = payoff(S0 * exp(drift + vol * z_hi), K);
+            sum += rule.gl_w[k]
+                   * (half_lo * f_lo * exp(-0.5 * z_lo * z_lo)
+                      + half_hi * f_hi * exp(-0.5 * z_hi * z_hi));
+        }
+        sum *= 0.3989422804014327;      // 1 / sqrt(2 pi)
+    }
+    else
+    {
+        for (int k = 0; k < rule.n; ++k)
+        {
+            double ST = S0 * exp(drift + vol * rule.gh_z[k]);
+            sum += rule.gh_w[k] * payoff(ST, K);
+        }
+    }
+    return exp(-r * T) * sum;
+}
+
+// Prices of the whole batch
+template <class Payoff>
+inline void quadrature_batch(const Payoff& payoff, const contract_batch& c,
+                             const quad_rule& rule, bool split, double* price)
+{
+    const ui64 n = c.n;
+    #pragma omp parallel for simd schedule(static)
+    for (ui64 i = 0; i < n; ++i)
+    {
+        price[i] = quadrature_price(payoff, c.S[i], c.K[i], c.T[i], c.r[i],
+                                    c.q[i], c.sigma[i], rule, split);
+    }
+}
+
+
+// Payoffs
+
+struct quad_call
+{
+    double operator()(double ST, double K) const
+    {
+        return std::max(ST - K, 0.0);
+    }
+    double kink(double K) const { return K; }
+};
+
+// Pays 1 if ST > K
+struct quad_cash_digital
+{
+    double operator()(double ST, double K) const
+    {
+        return ST > K ? 1.0 : 0.0;
+    }
+    double kink(double K) const { return K; }
+};
+
+// Pays ST if ST > K
+struct quad_asset_digital
+{
+    double operator()(double ST, double K) const
+    {
+        return ST > K ? ST : 0.0;
+    }
+    double kink(double K) const { return K; }
+};
+
+// Pays ln(ST / K), smooth
+struct quad_log_contract
+{
+    double operator()(double ST, double K) const
+    {
+        return log(ST / K);
+    }
+    double kink(double) const { return 0.0; }
+};
+
+
+// Prices the batch with both rules num_runs times, prints the max errors
+//  against the closed forms in ref
+template <class Payoff>
+inline void quadrature_report(const char* name, const Payoff& payoff,
+                              const contract_batch& c, const quad_rule& rule,
+                              ui64 num_runs, const double* ref, double* price)
+{
+    double t1 = dml_micros();
+    for (ui64 run = 0; run < num_runs; ++run)
+    {
+        quadrature_batch(payoff, c, rule, true, price);
+    }
+    double t2 = dml_micros();
+    double max_split = 0.0;
+    for (ui64 i = 0; i < c.n; ++i)
+        max_split = std::max(max_split, fabs(price[i] - ref[i]));
+
+    quadrature_batch(payoff, c, rule, false, price);
+    double max_plain = 0.0;
+    for (ui64 i = 0; i < c.n; ++i)
+        max_plain = std::max(max_plain, fabs(price[i] - ref[i]));
+
+    double seconds = (t2 - t1) / 1000000.0;
+    std::cout << " " << name << " max error split= " << std::scientific
+              << std::setprecision(3) << max_split << " gauss-hermite= "
+              << max_plain << std::fixed << std::setprecision(6) << ", "
+              << c.n * num_runs << " contracts in " << seconds
+              << " seconds, " << c.n * num_runs / seconds << " contracts/s"
+              << std::endl;
+}
+
+
+// num_simulations random contracts, num_nodes nodes
+inline void run_quadrature(ui64 num_simulations, ui64 num_runs,
+                           unsigned long long global_seed, int num_nodes)
+{
+    num_nodes = std::min(std::max(num_nodes, 2), QUAD_MAX_NODES);
+    quad_rule rule;
+    make_quad_rule(num_nodes, rule);
+
+    contract_batch c = alloc_contracts(num_simulations);
+    random_contracts(c, global_seed);
+    double* ref   = (double*)malloc(num_simulations * sizeof(double));
+    double* price = (double*)malloc(num_simulations * sizeof(double));
+    std::cout << " " << num_nodes << " nodes" << std::endl;
+
+    for (ui64 i = 0; i < c.n; ++i)
+        ref[i] = black_scholes_call(c.S[i], c.K[i], c.T[i], c.r[i], c.q[i],
+                                    c.sigma[i]);
+    quadrature_report("call", quad_call(), c, rule, num_runs, ref, price);
+
+    for (ui64 i = 0; i < c.n; ++i)
+        ref[i] = cash_or_nothing_call(c.S[i], c.K[i], 1.0, c.T[i], c.r[i],
+                                      c.q[i], c.sigma[i]);
+    quadrature_report("cash_digital", quad_cash_digital(), c, rule,
+                      num_runs, ref, price);
+
+    for (ui64 i = 0; i < c.n; ++i)
+        ref[i] = asset_or_nothing_call(c.S[i], c.K[i], c.T[i], c.r[i],
+                                       c.q[i], c.sigma[i]);
+    quadrature_report("asset_digital", quad_asset_digital(), c, rule,
+                      num_runs, ref, price);
+
+    for (ui64 i = 0; i < c.n; ++i)
+    {
+        double drift = (c.r[i] - c.q[i] - 0.5 * c.sigma[i] * c.sigma[i])
+                       * c.T[i];
+        ref[i] = exp(-c.r[i] * c.T[i]) * (log(c.S[i] / c.K[i]) + drift);
+    }
+    quadrature_report("log_contract", quad_log_contract(), c, rule,
+                      num_runs, ref, price);
+
+    free(ref);
+    free(price);
+    free_contracts(c);
+}
+
+#endif
@@ -0,0 +1,203 @@
+// Payoff sketches: distribution of the payoffs of the call mode without
+//  storing the samples, one sketch per thread, merged after the parallel
+//  region
+// Log-linear histogram of the non negative payoffs: the bucket of x > 0 is
+//  the top bits of its double, the exponent and the first SK_SUB_BITS bits
+//  of the mantissa, i.e. [2^e (1 + m 2^-b), 2^e (1 + (m + 1) 2^-b)), no log
+//  and no division; zero payoffs (out of the money paths) have their own
+//  counters, the exponents are clamped to [SK_MIN_EXP, SK_MAX_EXP)
+// The quantiles come from the same buckets (as DDSketch): the midpoint of a
+//  bucket is within 2^-(b+1) relative of every value in it (0.8% with 6
+//  bits) whatever the number of samples, and merging adds the counts, so
+//  the merged sketch is exactly the one of all the samples; t-digest or KLL
+//  would need sorting or compactions inside the pricing loop
+// Payoffs are sketched undiscounted, the discount factor (or any positive
+//  scale) is applied when reading, it does not change the relative error
+// Update, per tile of paths: the bucket indices are computed in a vector
+//  loop (integer operations on the bits, zeros go to SK_ZERO_BINS counters
+//  in turn so they are not one chain of increments of the same counter),
+//  then one increment per path
+// The increments cannot be vectorized, so the sketch can look at one tile
+//  in stride only: the tiles are i.i.d., the skipped ones only widen the
+//  sampling error of the quantiles (the price still uses every path)
+// Cost on the payoff loop alone (without the normals), ~1.3 ns per path:
+//  +0.9 ns per sketched path, so +4-7% with a stride of 16
+
+#ifndef SKETCH_HXX
+#define SKETCH_HXX
+
+#include <iostream>
+#include <iomanip>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+
+#include "mc_utils.hxx"
+#include "analytic.hxx"
+
+#define SK_SUB_BITS 6
+#define SK_MIN_EXP -24                  // 6e-8
+#define SK_MAX_EXP 24                   // 1.7e7
+#define SK_NUM_BINS ((SK_MAX_EXP - SK_MIN_EXP) << SK_SUB_BITS)
+#define SK_TILE 1024
+#define SK_ZERO_BINS 4
+
+struct payoff_sketch
+{
+    ui64     count;                     // Paths sketched
+    double   sum;                       // Of their payoffs
+    double   max;
+    ui64     stride;                    // Tiles per sketched tile
+    ui64     bins[SK_NUM_BINS + SK_ZERO_BINS];     // Zeros at the end
+    uint32_t tile[SK_TILE];             // Bucket indices of the current tile
+};
+
+inline payoff_sketch* alloc_sketches(int n, ui64 stride)
+{
+    payoff_sketch* sk = (payoff_sketch*)malloc(n * sizeof(payoff_sketch));
+    memset(sk, 0, n * sizeof(payoff_sketch));
+    for (int t = 0; t < n; ++t)
+        sk[t].stride = std::max(stride, (ui64)1);
+    return sk;
+}
+
+
+// Bucket of x > 0, x is clamped in the double domain first so the integer
+//  part needs no clamping (and vectorizes)
+inline uint32_t sketch_bin(double x)
+{
+    const double lo = 0x1p-24;                  // 2^SK_MIN_EXP
+    const double hi = 0x1.fffffffffffffp+23;    // Below 2^SK_MAX_EXP
+    x = x < lo ? lo : x;                        // Not std::min / max, they
+    x = x > hi ? hi : x;                        //  are branches for gcc here
+    uint64_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+    return (uint32_t)((bits >> (52 - SK_SUB_BITS))
+                      - ((uint64_t)(1023 + SK_MIN_EXP) << SK_SUB_BITS));
+}
+
+// Lower edge of bucket b
+inline double sketch_bin_low(ui64 b)
+{
+    double m = 1.0 + (double)(b & ((1 << SK_SUB_BITS) - 1))
+                     / (1 << SK_SUB_BITS);
+    return ldexp(m, (int)(b >> SK_SUB_BITS) + SK_MIN_EXP);
+}
+
+// Midpoint of bucket b
+inline double sketch_bin_value(ui64 b)
+{
+    return 0.5 * (sketch_bin_low(b) + sketch_bin_low(b + 1));
+}
+
+
+// Adds the payoffs (>= 0) of a tile of at most SK_TILE paths
+inline void sketch_add(payoff_sketch& sk, const double* x, ui64 n)
+{
+    double sum = 0.0, max = sk.max;
+    for (ui64 i = 0; i < n; ++i)
+    {
+        uint32_t zero = SK_NUM_BINS + (uint32_t)(i & (SK_ZERO_BINS - 1));
+        sk.tile[i] = x[i] > 0.0 ? sketch_bin(x[i]) : zero;
+        sum += x[i];
+        max  = x[i] > max ? x[i] : max;
+    }
+    for (ui64 i = 0; i < n; ++i)
+        sk.bins[sk.tile[i]]++;
+    sk.count += n;
+    sk.sum   += sum;
+    sk.max    = max;
+}
+
+inline ui64 sketch_zeros(const payoff_sketch& sk)
+{
+    ui64 zeros = 0;
+    for (ui64 b = SK_NUM_BINS; b < SK_NUM_BINS + SK_ZERO_BINS; ++b)
+        zeros += sk.bins[b];
+    return zeros;
+}
+
+// dst += src
+inline void merge_sketch(payoff_sketch& dst, const payoff_sketch& src)
+{
+    dst.count += src.count;
+    dst.sum   += src.sum;
+    dst.max    = std::max(dst.max, src.max);
+    for (ui64 b = 0; b < SK_NUM_BINS + SK_ZERO_BINS; ++b)
+        dst.bins[b] += src.bins[b];
+}
+
+
+// Quantile at level p of scale * payoff
+inline double sketch_quantile(const payoff_sketch& sk, double p, double scale)
+{
+    double rank = p * sk.count;
+    double seen = (double)sketch_zeros(sk);
+    if (rank < seen || sk.count == sketch_zeros(sk))
+        return 0.0;
+    for (ui64 b = 0; b < SK_NUM_BINS; ++b)
+    {
+        seen += sk.bins[b];
+        if (seen > rank)
+            return scale * std::min(sketch_bin_value(b), sk.max);
+    }
+    return scale * sk.max;
+}
+
+// Mean of scale * payoff over the paths above its p quantile (the
+//  expected shortfall of a short position), midpoints of the buckets
+inline double sketch_tail_mean(const payoff_sketch& sk, double p,
+                               double scale)
+{
+    double tail = (1.0 - p) * sk.count;
+    if (tail <= 0.0)
+        return scale * sk.max;
+    double left = tail, sum = 0.0;
+    for (ui64 b = SK_NUM_BINS; b-- > 0 && left > 0.0;)
+    {
+        double take = std::min((double)sk.bins[b], left);
+        sum  += take * std::min(sketch_bin_value(b), sk.max);
+        left -= take;
+    }
+    return scale * sum / tail;
+}
+
+
+// Payoff and P&L (premium received minus payoff paid) of a short call,
+//  exact payoff quantiles from the normal quantile of the terminal spot
+inline void sketch_report(const payoff_sketch& sk, double discount, double S0,
+                          double K, double drift, double vol)
+{
+    const int num_levels = 6;
+    const double levels[num_levels] = {0.5, 0.75, 0.9, 0.99, 0.999, 0.9999};
+    double premium = discount * sk.sum / sk.count;
+
+    std::cout << std::fixed << std::setprecision(6);
+    std::cout << " " << sk.count << " paths sketched, P(payoff = 0)= "
+              << (double)sketch_zeros(sk) / sk.count << ", mean= " << premium
+              << ", max= " << discount * sk.max << std::endl;
+    for (int l = 0; l < num_levels; ++l)
+    {
+        double p = levels[l];
+        double payoff = sketch_quantile(sk, p, discount);
+
+        // Exact: Phi^-1(p) by bisection on norm_cdf
+        double lo = -10.0, hi = 10.0;
+        for (int it = 0; it < 100; ++it)
+        {
+            double mid = 0.5 * (lo + hi);
+            (norm_cdf(mid) < p ? lo : hi) = mid;
+        }
+        double exact = discount * std::max(S0 * exp(drift + vol * lo) - K,
+                                           0.0);
+        std::cout << "  " << std::setprecision(2) << 100.0 * p
+                  << "%: payoff= " << std::setprecision(6) << payoff
+                  << " (exact " << exact << ") P&L " << std::setprecision(2)
+                  << 100.0 * (1.0 - p) << "%= " << std::setprecision(6)
+                  << premium - payoff << " ES= "
+                  << premium - sketch_tail_mean(sk, p, discount) << std::endl;
+    }
+}
+
+#endif
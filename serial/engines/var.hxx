@@ -0,0 +1,430 @@
+// VaR mode: Value-at-Risk and Expected Shortfall of an option book by full
+//  revaluation in simulated market scenarios
+// Outer level: scenarios of a common spot factor x (the log return of
+//  every underlying) and of a parallel vol shift dv, correlated, over a
+//  horizon of h trading days
+//      x  = s sqrt(h / 252) Z1 - s^2 h / 504
+//      dv = nu sqrt(h / 252) (rho Z1 + sqrt(1 - rho^2) Z2)
+// Inner level: every trade is repriced at T - h / 252 with S e^x and
+//  sigma + dv, vanillas with the closed form and the other terminal payoffs
+//  (asset digitals here) by quadrature_price, which takes any payoff of S_T
+// Trades with neither (path dependent ones, arithmetic Asian calls here)
+//  fall back on an inner Monte Carlo of VAR_INNER_PATHS paths per scenario,
+//  on the same normals for today's value and every scenario (common random
+//  numbers), so the losses do not carry the inner sampling noise; a new
+//  product of this kind is one more pricer next to var_asian_call
+// Whatever does not depend on the scenario (discounted strikes, dividend
+//  factors, square roots of the maturities, log-moneyness) is computed once
+//  per horizon, a vanilla costs a division and two erfc per scenario
+// Scenarios are split across the threads, each thread keeps the largest
+//  losses it has seen in a pre-sized min-heap of the tail size (streaming
+//  selection, no array of all the losses), the heaps are merged at the end
+
+#ifndef VAR_HXX
+#define VAR_HXX
+
+#include <iostream>
+#include <iomanip>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <functional>
+
+#include "mc_utils.hxx"
+#include "analytic_batch.hxx"
+#include "quadrature.hxx"
+
+#define VAR_TILE 1024
+#define VAR_QUAD_NODES 64
+
+// Inner Monte Carlo
+#define VAR_INNER_PATHS 256
+#define VAR_INNER_TILE 64
+#define VAR_ASIAN_DATES 12
+#define VAR_ASIAN_START (10.0 / 252.0)  // Longest horizon, no fixing before
+
+// Scenario model
+#define VAR_SPOT_VOL 0.2
+#define VAR_VOL_OF_VOL 0.3
+#define VAR_RHO -0.7
+#define VAR_MIN_VOL 0.01
+
+struct var_book
+{
+    contract_batch vanilla;
+    double*        vanilla_qty;
+    contract_batch digital;         // Asset-or-nothing calls
+    double*        digital_qty;
+    contract_batch asian;           // Arithmetic Asian calls
+    double*        asian_qty;
+};
+
+// Normals of the inner Monte Carlo, shared by all the scenarios
+struct var_inner_mc
+{
+    ui64    num_paths;
+    double* Z;          // (1 + VAR_ASIAN_DATES) x num_paths, date major
+};
+
+// Scenario independent part of the vanillas at the horizon
+struct var_vanilla_tables
+{
+    double* fwd;        // S e^-q(T - tau)
+    double* df;         // K e^-r(T - tau)
+    double* log_m;      // ln(S / K) + (r - q)(T - tau)
+    double* sqrt_T;
+};
+
+
+// Arithmetic Asian call seen at t <= VAR_ASIAN_START with spot S, average
+//  of the VAR_ASIAN_DATES dates evenly spaced on (VAR_ASIAN_START, T]
+// Paths by tiles as in gbm_stepped.hxx: one step to VAR_ASIAN_START, then
+//  one step per date
+inline double var_asian_call(const var_inner_mc& mc, double S, double K,
+                             double t, double T, double r, double q,
+                             double sigma)
+{
+    double mu     = r - q - 0.5 * sigma * sigma;
+    double t0     = VAR_ASIAN_START - t;
+    double dt     = (T - VAR_ASIAN_START) / VAR_ASIAN_DATES;
+    double start0 = log(S) + mu * t0;
+    double vol0   = sigma * sqrt(t0);
+    double drift  = mu * dt;
+    double vol    = sigma * sqrt(dt);
+    double sum    = 0.0;
+
+    for (ui64 start = 0; start < mc.num_paths; start += VAR_INNER_TILE)
+    {
+        ui64 len = std::min((ui64)VAR_INNER_TILE, mc.num_paths - start);
+        const double* Z = mc.Z + start;
+        double log_S[VAR_INNER_TILE], sum_S[VAR_INNER_TILE];
+        for (ui64 i = 0; i < len; ++i)
+        {
+            log_S[i] = start0 + vol0 * Z[i];
+            sum_S[i] = 0.0;
+        }
+        for (int d = 1; d <= VAR_ASIAN_DATES; ++d)
+        {
+            const double* Z_d = Z + d * mc.num_paths;
+            for (ui64 i = 0; i < len; ++i)
+            {
+                log_S[i] += drift + vol * Z_d[i];
+                sum_S[i] += exp(log_S[i]);
+            }
+        }
+        for (ui64 i = 0; i < len; ++i)
+        {
+            double payoff = sum_S[i] * (1.0 / VAR_ASIAN_DATES) - K;
+            sum += payoff > 0.0 ? payoff : 0.0;
+        }
+    }
+    return exp(-r * (T - t)) * sum / mc.num_paths;
+}
+
+
+// Book value with the spot factor and vol shift of one scenario, tau is
+//  the horizon in years
+inline double var_book_value(const var_book& book,
+                             const var_vanilla_tables& tab, double tau,
+                             double x, double dv, const quad_rule& rule,
+                             const var_inner_mc& mc)
+{
+    const contract_batch& c = book.vanilla;
+    double growth = exp(x);
+    double value  = 0.0;
+    #pragma omp simd reduction(+:value)
+    for (ui64 i = 0; i < c.n; ++i)
+    {
+        double sigma = std::max(c.sigma[i] + dv, VAR_MIN_VOL);
+        double vol   = sigma * tab.sqrt_T[i];
+        double d1    = (tab.log_m[i] + x) / vol + 0.5 * vol;
+        double d2    = d1 - vol;
+        double cp    = c.cp[i];
+        double N1    = 0.5 * erfc(-cp * d1 * M_SQRT1_2);
+        double N2    = 0.5 * erfc(-cp * d2 * M_SQRT1_2);
+        value += book.vanilla_qty[i]
+                 * cp * (tab.fwd[i] * growth * N1 - tab.df[i] * N2);
+    }
+
+    const contract_batch& d = book.digital;
+    quad_asset_digital payoff;
+    for (ui64 i = 0; i < d.n; ++i)
+    {
+        double sigma = std::max(d.sigma[i] + dv, VAR_MIN_VOL);
+        value += book.digital_qty[i]
+                 * quadrature_price(payoff, d.S[i] * growth, d.K[i],
+                                    d.T[i] - tau, d.r[i], d.q[i], sigma, rule,
+                                    true);
+    }
+
+    const contract_batch& a = book.asian;
+    for (ui64 i = 0; i < a.n; ++i)
+    {
+        double sigma = std::max(a.sigma[i] + dv, VAR_MIN_VOL);
+        value += book.asian_qty[i]
+                 * var_asian_call(mc, a.S[i] * growth, a.K[i], tau, a.T[i],
+                                  a.r[i], a.q[i], sigma);
+    }
+    return value;
+}
+
+
+// Adds loss to the min-heap of the k largest losses
+inline void var_push_loss(std::vector<double>& heap, ui64 k, double loss)
+{
+    if (heap.size() < k)
+    {
+        heap.push_back(loss);
+        std::push_heap(heap.begin(), heap.end(), std::greater<double>());
+    }
+    else if (loss > heap.front())
+    {
+        std::pop_heap(heap.begin(), heap.end(), std::greater<double>());
+        heap.back() = loss;
+        std::push_heap(heap.begin(), heap.end(), std::greater<double>());
+    }
+}
+
+
+// VaR at var_level and ES at es_level of the loss over h days, the
+//  scenarios use the 2 * num_scenarios normals past offset in the stream of
+//  global_seed
+inline void book_var(const var_book& book, const var_inner_mc& mc, double h,
+                     ui64 num_scenarios, unsigned long long global_seed,
+                     ui64 offset, double var_level, double es_level,
+                     double* var, double* es)
+{
+    const contract_batch& c = book.vanilla;
+    double tau = h / 252.0;
+    quad_rule rule;
+    make_quad_rule(VAR_QUAD_NODES, rule);
+
+    var_vanilla_tables tab;
+    tab.fwd    = (double*)malloc(c.n * sizeof(double));
+    tab.df     = (double*)malloc(c.n * sizeof(double));
+    tab.log_m  = (double*)malloc(c.n * sizeof(double));
+    tab.sqrt_T = (double*)malloc(c.n * sizeof(double));
+    for (ui64 i = 0; i < c.n; ++i)
+    {
+        double T      = c.T[i] - tau;
+        tab.fwd[i]    = c.S[i] * exp(-c.q[i] * T);
+        tab.df[i]     = c.K[i] * exp(-c.r[i] * T);
+        tab.log_m[i]  = log(c.S[i] / c.K[i]) + (c.r[i] - c.q[i]) * T;
+        tab.sqrt_T[i] = sqrt(T);
+    }
+
+    int num_threads = get_num_threads();
+    ui64 chunk = (num_scenarios + num_threads - 1) / num_threads;
+
+    // Today's value: no move, full maturity
+    double base = 0.0;
+    for (ui64 i = 0; i < c.n; ++i)
+    {
+        double price = c.cp[i] > 0.0
+            ? black_scholes_call(c.S[i], c.K[i], c.T[i], c.r[i], c.q[i],
+                                 c.sigma[i])
+            : black_scholes_put(c.S[i], c.K[i], c.T[i], c.r[i], c.q[i],
+                                c.sigma[i]);
+        base += book.vanilla_qty[i] * price;
+    }
+    for (ui64 i = 0; i < book.digital.n; ++i)
+    {
+        const contract_batch& d = book.digital;
+        base += book.digital_qty[i]
+                * asset_or_nothing_call(d.S[i], d.K[i], d.T[i], d.r[i],
+                                        d.q[i], d.sigma[i]);
+    }
+    for (ui64 i = 0; i < book.asian.n; ++i)
+    {
+        const contract_batch& a = book.asian;
+        base += book.asian_qty[i]
+                * var_asian_call(mc, a.S[i], a.K[i], 0.0, a.T[i], a.r[i],
+                                 a.q[i], a.sigma[i]);
+    }
+
+    // Tail sizes
+    ui64 k_var = (ui64)ceil((1.0 - var_level) * num_scenarios);
+    ui64 k_es  = (ui64)ceil((1.0 - es_level) * num_scenarios);
+    ui64 k     = std::max(std::max(k_var, k_es), (ui64)1);
+
+    double scale = sqrt(tau);
+    double x_vol = VAR_SPOT_VOL * scale;
+    double v_vol = VAR_VOL_OF_VOL * scale;
+    double rho_c = sqrt(1.0 - VAR_RHO * VAR_RHO);
+
+    VSLStreamStatePtr parallel_streams[num_threads];
+    init_streams(parallel_streams, num_threads, global_seed, 2 * chunk,
+                 offset);
+    std::vector<std::vector<double> > heaps(num_threads);
+
+    #pragma omp parallel default(shared)
+    {
+        int rank = get_thread_rank();
+        std::vector<double>& heap = heaps[rank];
+        heap.reserve(k);
+        double* Z = (double*)malloc(2 * VAR_TILE * sizeof(double));
+        ui64 first = std::min(rank * chunk, num_scenarios);
+        ui64 len   = std::min(chunk, num_scenarios - first);
+
+        for (ui64 start = 0; start < len; start += VAR_TILE)
+        {
+            ui64 tile = std::min((ui64)VAR_TILE, len - start);
+            gaussian_armpl(2 * tile, Z, parallel_streams[rank]);
+            for (ui64 s = 0; s < tile; ++s)
+            {
+                double Z1 = Z[2 * s], Z2 = Z[2 * s + 1];
+                double x  = x_vol * Z1 - 0.5 * x_vol * x_vol;
+                double dv = v_vol * (VAR_RHO * Z1 + rho_c * Z2);
+                double loss = base - var_book_value(book, tab, tau, x, dv,
+                                                    rule, mc);
+                var_push_loss(heap, k, loss);
+            }
+        }
+        free(Z);
+    }
+    delete_streams(parallel_streams, num_threads);
+
+    // Largest k losses overall, in decreasing order
+    std::vector<double> tail;
+    for (int t = 0; t < num_threads; ++t)
+        tail.insert(tail.end(), heaps[t].begin(), heaps[t].end());
+    std::sort(tail.begin(), tail.end(), std::greater<double>());
+    tail.resize(std::min(k, (ui64)tail.size()));
+
+    *var = tail[std::min(std::max(k_var, (ui64)1), (ui64)tail.size()) - 1];
+    double sum = 0.0;
+    ui64 n_es  = std::min(std::max(k_es, (ui64)1), (ui64)tail.size());
+    for (ui64 i = 0; i < n_es; ++i)
+        sum += tail[i];
+    *es = sum / n_es;
+
+    free(tab.fwd);
+    free(tab.df);
+    free(tab.log_m);
+    free(tab.sqrt_T);
+}
+
+
+// num_simulations * num_runs scenarios, num_trades trades (5% asset
+//  digitals, 0.1% Asian calls), 1 and 10 day 99% VaR and 97.5% ES, with the
+//  delta-normal VaR of the same book as a sanity check
+inline void run_var(ui64 num_simulations, ui64 num_runs,
+                    unsigned long long global_seed, ui64 num_trades)
+{
+    ui64 num_digital = num_trades / 20;
+    ui64 num_asian   = num_trades / 1000;
+    var_book book;
+    book.vanilla = alloc_contracts(num_trades - num_digital - num_asian);
+    book.digital = alloc_contracts(num_digital);
+    book.asian   = alloc_contracts(num_asian);
+    book.vanilla_qty = (double*)malloc(book.vanilla.n * sizeof(double));
+    book.digital_qty = (double*)malloc(book.digital.n * sizeof(double));
+    book.asian_qty   = (double*)malloc(book.asian.n * sizeof(double));
+
+    // Everything comes from the stream of global_seed, in disjoint parts:
+    //  the contracts, the quantities, the inner normals, the scenarios
+    ui64 contract_span = get_num_threads() * 7 * num_trades;
+    ui64 offset = 0;
+    random_contracts(book.vanilla, global_seed, offset);
+    offset += contract_span;
+    random_contracts(book.digital, global_seed, offset);
+    offset += contract_span;
+    random_contracts(book.asian, global_seed, offset);
+    offset += contract_span;
+
+    // Quantities in [-100, 100], the maturities past the 10 day horizon
+    VSLStreamStatePtr streams[1];
+    init_streams(streams, 1, global_seed, 0, offset);
+    uniform_armpl(book.vanilla.n, book.vanilla_qty, streams[0]);
+    uniform_armpl(book.digital.n, book.digital_qty, streams[0]);
+    uniform_armpl(book.asian.n, book.asian_qty, streams[0]);
+    delete_streams(streams, 1);
+    offset += num_trades;
+    for (ui64 i = 0; i < book.vanilla.n; ++i)
+    {
+        book.vanilla_qty[i] = 200.0 * book.vanilla_qty[i] - 100.0;
+        book.vanilla.T[i]  += 10.0 / 252.0;
+    }
+    for (ui64 i = 0; i < book.digital.n; ++i)
+    {
+        book.digital_qty[i] = 200.0 * book.digital_qty[i] - 100.0;
+        book.digital.T[i]  += 10.0 / 252.0;
+        book.digital.cp[i]  = 1.0;
+    }
+    for (ui64 i = 0; i < book.asian.n; ++i)
+    {
+        book.asian_qty[i] = 200.0 * book.asian_qty[i] - 100.0;
+        book.asian.T[i]  += VAR_ASIAN_START;
+        book.asian.cp[i]  = 1.0;
+    }
+
+    // Inner normals of the Asians, common to every scenario
+    var_inner_mc mc;
+    mc.num_paths = VAR_INNER_PATHS;
+    mc.Z = (double*)malloc((1 + VAR_ASIAN_DATES) * mc.num_paths
+                           * sizeof(double));
+    init_streams(streams, 1, global_seed, 0, offset);
+    gaussian_armpl((1 + VAR_ASIAN_DATES) * mc.num_paths, mc.Z, streams[0]);
+    delete_streams(streams, 1);
+    offset += (1 + VAR_ASIAN_DATES) * mc.num_paths;
+
+    // Dollar delta of the book for the delta-normal VaR, the Asians by
+    //  central differences on the common inner normals
+    greeks_batch g = alloc_greeks(book.vanilla.n);
+    black_scholes_batch(book.vanilla, g);
+    double dollar_delta = 0.0;
+    for (ui64 i = 0; i < book.vanilla.n; ++i)
+        dollar_delta += book.vanilla_qty[i] * g.delta[i] * book.vanilla.S[i];
+    free_greeks(g);
+    for (ui64 i = 0; i < book.digital.n; ++i)
+    {
+        const contract_batch& d = book.digital;
+        dollar_delta += book.digital_qty[i] * d.S[i]
+                        * asset_or_nothing_delta(d.S[i], d.K[i], d.T[i],
+                                                 d.r[i], d.q[i], d.sigma[i]);
+    }
+    for (ui64 i = 0; i < book.asian.n; ++i)
+    {
+        const contract_batch& a = book.asian;
+        double hS = 0.01 * a.S[i];
+        double up = var_asian_call(mc, a.S[i] + hS, a.K[i], 0.0, a.T[i],
+                                   a.r[i], a.q[i], a.sigma[i]);
+        double dn = var_asian_call(mc, a.S[i] - hS, a.K[i], 0.0, a.T[i],
+                                   a.r[i], a.q[i], a.sigma[i]);
+        dollar_delta += book.asian_qty[i] * a.S[i] * (up - dn) / (2.0 * hS);
+    }
+
+    // The runs are pooled: one tail over all the scenarios
+    ui64 num_scenarios = num_simulations * num_runs;
+    const double horizons[2] = {1.0, 10.0};
+    std::cout << std::fixed << std::setprecision(3);
+    for (int hz = 0; hz < 2; ++hz)
+    {
+        double h = horizons[hz];
+        double var = 0.0, es = 0.0;
+        double t1 = dml_micros();
+        book_var(book, mc, h, num_scenarios, global_seed, offset, 0.99, 0.975,
+                 &var, &es);
+        double t2 = dml_micros();
+        double seconds = (t2 - t1) / 1000000.0;
+        double delta_normal = 2.326347874 * fabs(dollar_delta)
+                              * VAR_SPOT_VOL * sqrt(h / 252.0);
+        std::cout << " " << h << " day VaR 99%= " << var << " ES 97.5%= "
+                  << es << " delta-normal VaR= " << delta_normal
+                  << std::endl;
+        std::cout << "  " << num_scenarios << " scenarios x " << num_trades
+                  << " trades in " << std::setprecision(6) << seconds
+                  << " seconds, " << num_scenarios * num_trades / seconds
+                  << " repricings/s" << std::setprecision(3) << std::endl;
+    }
+
+    free(mc.Z);
+    free(book.vanilla_qty);
+    free(book.digital_qty);
+    free(book.asian_qty);
+    free_contracts(book.vanilla);
+    free_contracts(book.digital);
+    free_contracts(book.asian);
+}
+
+#endif